@@ -0,0 +1,480 @@
+/*
+ * Copyright 2013-2020 Stefan Widgren and Maria Noremark,
+ * National Veterinary Institute, Sweden
+ *
+ * Licensed under the EUPL, Version 1.1 or - as soon they
+ * will be approved by the European Commission - subsequent
+ * versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the
+ * Licence.
+ * You may obtain a copy of the Licence at:
+ *
+ * http: *ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in
+ * writing, software distributed under the Licence is
+ * distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the Licence for the specific language governing
+ * permissions and limitations under the Licence.
+ */
+
+
+/*
+ * Temporal closeness and betweenness centrality of the holdings in a
+ * prepared contacts index, see Centrality in R.
+ *
+ * The distance from s to v is the minimum number of contacts in a
+ * chain of contacts from s to v in non-decreasing time within the
+ * time window, i.e. the distance in ShortestPaths. The forward
+ * search from a source is a breadth-first search over states
+ * (v, t, j): holding v reached with j contacts where the last
+ * contact was on day t. A state is dropped if v was reached with
+ * fewer contacts on day t or earlier, since then no chain through
+ * the state is a shortest chain. The number of chains to each state
+ * is counted level by level, and the dependencies of Brandes (2001)
+ * are then accumulated back from the last level. The states are
+ * kept per day and not only per holding, since a shortest chain to
+ * one holding can pass another holding on a chain that is not the
+ * shortest to that holding.
+ *
+ * The distances to a source are found with a backward search on the
+ * ingoing contacts, where only the latest day of each holding on a
+ * level is kept. The sources are traced in parallel with OpenMP,
+ * each thread with its own work memory and sums, and the sums are
+ * added when all sources are traced.
+ */
+
+#include "contacts.h"
+
+#include <algorithm>
+#include <climits>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* A state of the forward search, see above. */
+struct CentralityState {
+    int node;
+    int t;
+    double sigma;
+    double delta;
+
+    bool operator<(const CentralityState& other) const {
+        if (node != other.node)
+            return node < other.node;
+        return t < other.t;
+    }
+};
+
+/* The dependency of a state on the next level, with the day of the
+ * contact to it. */
+struct CentralityContact {
+    int t;
+    double delta;
+
+    bool operator<(const CentralityContact& other) const {
+        return t < other.t;
+    }
+};
+
+static CentralityState
+centralityState(int node, int t)
+{
+    CentralityState state = {node, t, 0, 0};
+    return state;
+}
+
+/* The work memory and the sums of one thread. The nodes are internal
+ * identifiers. */
+class TemporalCentrality {
+public:
+    TemporalCentrality(const ContactsIndex& index, int tBegin, int tEnd)
+        : inCloseness(index.N(), 0),
+          outCloseness(index.N(), 0),
+          betweenness(index.N(), 0),
+          index(index),
+          tBegin(tBegin),
+          tEnd(tEnd),
+          distance(index.N(), 0),
+          sigma(index.N(), 0),
+          earliest(index.N(), INT_MAX),
+          latest(index.N(), INT_MIN)
+        {}
+
+    /* Add the contributions of a source to the sums. */
+    void Source(int source) {
+        Forward(source);
+        Backward(source);
+    }
+
+    /* The sums of 1 / distance from the sources to each node and from
+     * each node to the sources, and the sums of the dependencies of
+     * the sources on each node. */
+    std::vector<double> inCloseness;
+    std::vector<double> outCloseness;
+    std::vector<double> betweenness;
+
+private:
+    const ContactsIndex& index;
+    int tBegin;
+    int tEnd;
+
+    /* The distance from the source, the number of shortest chains
+     * and the earliest day of the nodes in the forward search. */
+    std::vector<int> distance;
+    std::vector<double> sigma;
+    std::vector<int> earliest;
+
+    /* The latest day of the nodes in the backward search. */
+    std::vector<int> latest;
+
+    /* The reached nodes, to reset the work memory. */
+    std::vector<int> reached;
+
+    /* The states of each level, sorted on (node, t). */
+    std::vector<std::vector<CentralityState> > levels;
+
+    std::vector<double> sums;
+    std::vector<CentralityContact> contacts;
+    std::vector<std::pair<int, int> > frontier, next;
+
+    /* The range of states of the node that starts at first. */
+    static size_t Last(const std::vector<CentralityState>& level,
+                       size_t first)
+    {
+        size_t last = first;
+
+        while (last < level.size() && level[last].node == level[first].node)
+            last++;
+
+        return last;
+    }
+
+    /* Add a level with the states that the contacts from the states
+     * of the last level lead to. */
+    void Expand(void) {
+        const ContactsLookup& data = index.outgoing;
+        const std::vector<CentralityState>& level = levels.back();
+        int j = levels.size();
+        std::vector<CentralityState> states;
+
+        for (size_t first = 0, last; first < level.size(); first = last) {
+            int node = level[first].node;
+            last = Last(level, first);
+
+            /* The number of chains to the states of the node up to
+             * each day. */
+            sums.clear();
+            for (size_t i = first; i < last; ++i)
+                sums.push_back((sums.empty() ? 0 : sums.back()) + level[i].sigma);
+
+            ContactsEdges edges(data, node, level[first].t, tEnd);
+            for (int i = 0; i < edges.Size(); ++i) {
+                int e = edges[i];
+                int neighbour = data.neighbour[e];
+                const int *t_begin =
+                    contactsLowerBound(data.Begin(e), data.End(e),
+                                       level[first].t);
+                const int *t_end =
+                    contactsUpperBound(t_begin, data.End(e), tEnd);
+
+                for (const int *iit = t_begin; iit != t_end; ++iit) {
+                    /* The contacts on the same day are one step. */
+                    if (iit != t_begin && *iit == *(iit - 1))
+                        continue;
+
+                    /* The neighbour was reached on a previous level
+                     * on the same day or earlier, which is also the
+                     * case for the source and for loops. */
+                    if (earliest[neighbour] <= *iit)
+                        break;
+
+                    size_t k = std::upper_bound(
+                        level.begin() + first, level.begin() + last,
+                        centralityState(node, *iit)) - level.begin() - first;
+
+                    CentralityState state = centralityState(neighbour, *iit);
+                    state.sigma = sums[k - 1];
+                    states.push_back(state);
+                }
+            }
+        }
+
+        /* Merge the states of the same node and day. */
+        std::sort(states.begin(), states.end());
+        size_t n = 0;
+        for (size_t i = 0; i < states.size(); ++i) {
+            if (n > 0 && states[n - 1].node == states[i].node &&
+                states[n - 1].t == states[i].t) {
+                states[n - 1].sigma += states[i].sigma;
+            } else {
+                states[n++] = states[i];
+            }
+        }
+        states.resize(n);
+
+        for (size_t i = 0; i < states.size(); ++i) {
+            int node = states[i].node;
+
+            if (earliest[node] == INT_MAX && distance[node] == 0) {
+                reached.push_back(node);
+                distance[node] = j;
+            }
+            if (distance[node] == j)
+                sigma[node] += states[i].sigma;
+        }
+
+        /* The states are sorted on the day within each node. */
+        for (size_t i = 0; i < states.size(); ++i) {
+            if (states[i].t < earliest[states[i].node])
+                earliest[states[i].node] = states[i].t;
+        }
+
+        levels.push_back(std::vector<CentralityState>());
+        levels.back().swap(states);
+    }
+
+    /* Accumulate the dependencies from the last level to the first,
+     * and add the dependencies of the states to the betweenness of
+     * their nodes. The dependency of a state is the sum of the
+     * dependencies of the states that it leads to on the next level,
+     * plus 1 / sigma for a state on a shortest chain to its node. */
+    void Accumulate(void) {
+        const ContactsLookup& data = index.outgoing;
+
+        for (size_t j = levels.size() - 1; j > 0; --j) {
+            std::vector<CentralityState>& level = levels[j];
+            const std::vector<CentralityState> *next =
+                j + 1 < levels.size() ? &levels[j + 1] : NULL;
+
+            for (size_t first = 0, last; first < level.size(); first = last) {
+                int node = level[first].node;
+                last = Last(level, first);
+
+                /* The dependencies of the states on the next level
+                 * that the contacts of the node lead to, summed from
+                 * the last day. */
+                contacts.clear();
+                if (next) {
+                    ContactsEdges edges(data, node, level[first].t, tEnd);
+                    for (int i = 0; i < edges.Size(); ++i) {
+                        int e = edges[i];
+                        int neighbour = data.neighbour[e];
+                        const int *t_begin =
+                            contactsLowerBound(data.Begin(e), data.End(e),
+                                               level[first].t);
+                        const int *t_end =
+                            contactsUpperBound(t_begin, data.End(e), tEnd);
+
+                        for (const int *iit = t_begin; iit != t_end; ++iit) {
+                            if (iit != t_begin && *iit == *(iit - 1))
+                                continue;
+
+                            /* The state was dropped in Expand, and so
+                             * are the states of the later days. */
+                            std::vector<CentralityState>::const_iterator it =
+                                std::lower_bound(next->begin(), next->end(),
+                                                 centralityState(neighbour,
+                                                                 *iit));
+                            if (it == next->end() || it->node != neighbour ||
+                                it->t != *iit)
+                                break;
+
+                            CentralityContact contact = {*iit, it->delta};
+                            contacts.push_back(contact);
+                        }
+                    }
+
+                    std::sort(contacts.begin(), contacts.end());
+                    for (size_t i = contacts.size(); i-- > 1;)
+                        contacts[i - 1].delta += contacts[i].delta;
+                }
+
+                for (size_t i = first; i < last; ++i) {
+                    CentralityState& state = level[i];
+                    CentralityContact key = {state.t, 0};
+                    size_t k = std::lower_bound(contacts.begin(),
+                                                contacts.end(), key) -
+                        contacts.begin();
+
+                    state.delta = k < contacts.size() ? contacts[k].delta : 0;
+                    betweenness[node] += state.sigma * state.delta;
+
+                    if (distance[node] == (int)j)
+                        state.delta += 1.0 / sigma[node];
+                }
+            }
+        }
+    }
+
+    void Forward(int source) {
+        levels.resize(1);
+        levels[0].assign(1, centralityState(source, tBegin));
+        levels[0][0].sigma = 1;
+        earliest[source] = tBegin;
+        reached.push_back(source);
+
+        while (!levels.back().empty())
+            Expand();
+        levels.pop_back();
+
+        Accumulate();
+
+        for (size_t i = 0; i < reached.size(); ++i) {
+            int node = reached[i];
+
+            if (node != source)
+                inCloseness[node] += 1.0 / distance[node];
+            distance[node] = 0;
+            sigma[node] = 0;
+            earliest[node] = INT_MAX;
+        }
+        reached.clear();
+    }
+
+    /* Search back from the source on the ingoing contacts, where a
+     * node on a level is kept with the latest day of a contact from
+     * it that starts a chain to the source. */
+    void Backward(int source) {
+        const ContactsLookup& data = index.ingoing;
+
+        frontier.assign(1, std::make_pair(source, tEnd));
+        latest[source] = tEnd;
+        reached.push_back(source);
+
+        for (int d = 1; !frontier.empty(); ++d) {
+            next.clear();
+            for (size_t i = 0; i < frontier.size(); ++i) {
+                int node = frontier[i].first;
+                int t = frontier[i].second;
+
+                ContactsEdges edges(data, node, tBegin, t);
+                for (int j = 0; j < edges.Size(); ++j) {
+                    int e = edges[j];
+                    int neighbour = data.neighbour[e];
+                    const int *t_end =
+                        contactsUpperBound(data.Begin(e), data.End(e), t);
+
+                    if (t_end != data.Begin(e) && *(t_end - 1) >= tBegin &&
+                        *(t_end - 1) > latest[neighbour])
+                        next.push_back(std::make_pair(neighbour, *(t_end - 1)));
+                }
+            }
+
+            /* Keep the latest day of each node. */
+            std::sort(next.begin(), next.end());
+            frontier.clear();
+            for (size_t i = 0; i < next.size(); ++i) {
+                if (i + 1 < next.size() && next[i + 1].first == next[i].first)
+                    continue;
+                frontier.push_back(next[i]);
+            }
+
+            for (size_t i = 0; i < frontier.size(); ++i) {
+                int node = frontier[i].first;
+
+                if (latest[node] == INT_MIN) {
+                    reached.push_back(node);
+                    outCloseness[node] += 1.0 / d;
+                }
+                latest[node] = frontier[i].second;
+            }
+        }
+
+        for (size_t i = 0; i < reached.size(); ++i)
+            latest[reached[i]] = INT_MIN;
+        reached.clear();
+    }
+
+    TemporalCentrality(const TemporalCentrality&);
+    TemporalCentrality& operator=(const TemporalCentrality&);
+};
+
+/* The centrality of the holdings in a prepared index, see
+ * ContactsIndex in R.
+ *
+ * @param image the image of the index.
+ * @param source the one-based sources to trace.
+ * @param tBegin the start of the time window.
+ * @param tEnd the end of the time window.
+ * @param threads the number of threads, or 0 for the OpenMP default.
+ * @return a list with inCloseness, outCloseness and betweenness of
+ * each holding in the index, summed over the sources.
+ */
+extern "C" SEXP contactsCentrality(
+    SEXP image,
+    SEXP source,
+    SEXP tBegin,
+    SEXP tEnd,
+    SEXP threads)
+{
+    const char *names[] = {"inCloseness", "outCloseness", "betweenness", ""};
+    ContactsIndex index;
+    std::vector<TemporalCentrality*> work;
+    int n, len;
+    SEXP result, vec;
+
+    if (!Rf_isInteger(source) ||
+        !Rf_isInteger(tBegin) || Rf_xlength(tBegin) != 1 ||
+        INTEGER(tBegin)[0] == NA_INTEGER ||
+        !Rf_isInteger(tEnd) || Rf_xlength(tEnd) != 1 ||
+        INTEGER(tEnd)[0] == NA_INTEGER ||
+        !Rf_isInteger(threads) || Rf_xlength(threads) != 1 ||
+        INTEGER(threads)[0] == NA_INTEGER || INTEGER(threads)[0] < 0 ||
+        readContactsIndex(index, image))
+        Rf_error("Unable to calculate the centrality");
+
+    len = Rf_length(source);
+    for (int i = 0; i < len; ++i) {
+        if (INTEGER(source)[i] == NA_INTEGER || INTEGER(source)[i] < 1 ||
+            INTEGER(source)[i] > index.N())
+            Rf_error("Unable to calculate the centrality");
+    }
+
+    n = contactsThreads(INTEGER(threads)[0]);
+
+    for (int i = 0; i < n; ++i) {
+        work.push_back(new TemporalCentrality(index, INTEGER(tBegin)[0],
+                                              INTEGER(tEnd)[0]));
+    }
+
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(n) schedule(dynamic, 1)
+#endif
+    for (int i = 0; i < len; ++i) {
+#ifdef _OPENMP
+        TemporalCentrality *w = work[omp_get_thread_num()];
+#else
+        TemporalCentrality *w = work[0];
+#endif
+        w->Source(index.Internal(INTEGER(source)[i] - 1));
+    }
+
+    PROTECT(result = Rf_mkNamed(VECSXP, names));
+    for (int k = 0; k < 3; ++k) {
+        SET_VECTOR_ELT(result, k, vec = Rf_allocVector(REALSXP, index.N()));
+        for (int i = 0; i < index.N(); ++i) {
+            double sum = 0;
+
+            for (int j = 0; j < n; ++j) {
+                const std::vector<double>& x =
+                    k == 0 ? work[j]->inCloseness :
+                    k == 1 ? work[j]->outCloseness :
+                    work[j]->betweenness;
+                sum += x[index.Internal(i)];
+            }
+            REAL(vec)[i] = sum;
+        }
+    }
+
+    for (int j = 0; j < n; ++j)
+        delete work[j];
+
+    UNPROTECT(1);
+
+    return result;
+}
@@ -0,0 +1,983 @@
+/*
+ * Copyright 2013-2020 Stefan Widgren and Maria Noremark,
+ * National Veterinary Institute, Sweden
+ *
+ * Licensed under the EUPL, Version 1.1 or - as soon they
+ * will be approved by the European Commission - subsequent
+ * versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the
+ * Licence.
+ * You may obtain a copy of the Licence at:
+ *
+ * http: *ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in
+ * writing, software distributed under the Licence is
+ * distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the Licence for the specific language governing
+ * permissions and limitations under the Licence.
+ */
+
+#include "contacts.h"
+#include <string.h>
+
+#include <algorithm>
+#include <climits>
+#include <utility>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* Help class to sort nodes on degree with ties broken on the
+ * identifier. */
+class CompareDegree {
+public:
+    CompareDegree(const std::vector<R_xlen_t>& degree, bool decreasing)
+        : degree(degree), decreasing(decreasing)
+        {}
+
+    bool operator()(int a, int b) const {
+        if (degree[a] != degree[b])
+            return decreasing ? degree[a] > degree[b] : degree[a] < degree[b];
+        return a < b;
+    }
+
+private:
+    const std::vector<R_xlen_t>& degree;
+    bool decreasing;
+};
+
+/* Help class to sort rows on t. */
+class CompareTime {
+public:
+    CompareTime(const int *t) : t(t) {}
+
+    bool operator()(R_xlen_t a, R_xlen_t b) const {
+        return t[a] < t[b];
+    }
+
+private:
+    const int *t;
+};
+
+/* The vector in the lookup for rowids of type T, see
+ * ContactsLookup::rowid. */
+static std::vector<int>&
+rowidVector(ContactsLookup& lookup, int)
+{
+    return lookup.rowid;
+}
+
+static std::vector<R_xlen_t>&
+rowidVector(ContactsLookup& lookup, R_xlen_t)
+{
+    return lookup.longRowid;
+}
+
+/* Stable counting sort of the rows on key. */
+template <typename T>
+static void
+countingSort(std::vector<T>& rows, const int *key, int n)
+{
+    std::vector<T> offset(n + 1, 0);
+    std::vector<T> sorted(rows.size());
+
+    for (size_t i = 0; i < rows.size(); ++i)
+        offset[key[rows[i]] + 1]++;
+    for (int i = 0; i < n; ++i)
+        offset[i + 1] += offset[i];
+    for (size_t i = 0; i < rows.size(); ++i)
+        sorted[offset[key[rows[i]]]++] = rows[i];
+
+    rows.swap(sorted);
+}
+
+/* Build the lookup from the zero-based node 'from' to the zero-based
+ * node 'to' of each row. The rows must be sorted by t. */
+template <typename T>
+static void
+buildLookup(ContactsLookup& lookup,
+            const std::vector<T>& rows,
+            const int *from,
+            const int *to,
+            const int *t,
+            int n)
+{
+    std::vector<T> sorted(rows);
+    std::vector<T>& rowid = rowidVector(lookup, T());
+    size_t len = sorted.size();
+
+    /* Sort the rows on (from, to) and keep the order by t within
+     * each pair. */
+    countingSort(sorted, to, n);
+    countingSort(sorted, from, n);
+
+    lookup.nodeOffset.assign(n + 1, 0);
+    lookup.neighbour.clear();
+    lookup.edgeOffset.assign(1, 0);
+    lookup.t.resize(len);
+    lookup.rowid.clear();
+    lookup.longRowid.clear();
+    rowid.resize(len);
+
+    for (size_t i = 0; i < len; ++i) {
+        T j = sorted[i];
+
+        if (i == 0 || from[j] != from[sorted[i - 1]] || to[j] != to[sorted[i - 1]]) {
+            if (i > 0)
+                lookup.edgeOffset.push_back(i);
+            lookup.neighbour.push_back(to[j]);
+            lookup.nodeOffset[from[j] + 1]++;
+        }
+
+        lookup.t[i] = t[j];
+        rowid[i] = j;
+    }
+
+    if (len)
+        lookup.edgeOffset.push_back(len);
+    for (int i = 0; i < n; ++i)
+        lookup.nodeOffset[i + 1] += lookup.nodeOffset[i];
+}
+
+/* Move the blocks of the nodes in the lookup to the order of the
+ * internal identifiers. The edges of a node keep their order. */
+static void
+relabelLookup(ContactsLookup& lookup,
+              const std::vector<int>& internal,
+              const std::vector<int>& external)
+{
+    ContactsLookup result;
+    int n = external.size();
+
+    result.nodeOffset.assign(n + 1, 0);
+    result.neighbour.reserve(lookup.neighbour.size());
+    result.edgeOffset.reserve(lookup.edgeOffset.size());
+    result.edgeOffset.push_back(0);
+    result.t.reserve(lookup.t.size());
+    result.rowid.reserve(lookup.rowid.size());
+    result.longRowid.reserve(lookup.longRowid.size());
+
+    for (int v = 0; v < n; ++v) {
+        int node = external[v];
+
+        for (int e = lookup.nodeOffset[node]; e < lookup.nodeOffset[node + 1]; ++e) {
+            result.neighbour.push_back(internal[lookup.neighbour[e]]);
+            result.t.insert(result.t.end(),
+                            lookup.t.begin() + lookup.edgeOffset[e],
+                            lookup.t.begin() + lookup.edgeOffset[e + 1]);
+            if (lookup.longRowid.empty()) {
+                result.rowid.insert(result.rowid.end(),
+                                    lookup.rowid.begin() + lookup.edgeOffset[e],
+                                    lookup.rowid.begin() + lookup.edgeOffset[e + 1]);
+            } else {
+                result.longRowid.insert(result.longRowid.end(),
+                                        lookup.longRowid.begin() + lookup.edgeOffset[e],
+                                        lookup.longRowid.begin() + lookup.edgeOffset[e + 1]);
+            }
+            result.edgeOffset.push_back(result.t.size());
+        }
+
+        result.nodeOffset[v + 1] = result.neighbour.size();
+    }
+
+    std::swap(lookup.nodeOffset, result.nodeOffset);
+    std::swap(lookup.neighbour, result.neighbour);
+    std::swap(lookup.edgeOffset, result.edgeOffset);
+    std::swap(lookup.t, result.t);
+    std::swap(lookup.rowid, result.rowid);
+    std::swap(lookup.longRowid, result.longRowid);
+}
+
+/* Reverse Cuthill-McKee order of the nodes, where the neighbours of
+ * a node are the union of its ingoing and outgoing neighbours. */
+static void
+orderRCM(const ContactsLookup& ingoing,
+         const ContactsLookup& outgoing,
+         int n,
+         std::vector<int>& external)
+{
+    std::vector<R_xlen_t> degree(n);
+    std::vector<int> start(n), neighbours;
+    std::vector<bool> visited(n, false);
+
+    for (int v = 0; v < n; ++v) {
+        degree[v] = (ingoing.nodeOffset[v + 1] - ingoing.nodeOffset[v]) +
+            (outgoing.nodeOffset[v + 1] - outgoing.nodeOffset[v]);
+        start[v] = v;
+    }
+
+    /* Start each component from a node with the lowest degree. */
+    std::sort(start.begin(), start.end(), CompareDegree(degree, false));
+
+    external.clear();
+    for (int i = 0; i < n; ++i) {
+        if (visited[start[i]])
+            continue;
+
+        size_t head = external.size();
+        visited[start[i]] = true;
+        external.push_back(start[i]);
+
+        while (head < external.size()) {
+            int v = external[head++];
+
+            neighbours.clear();
+            for (int dir = 0; dir < 2; ++dir) {
+                const ContactsLookup& lookup = dir ? outgoing : ingoing;
+
+                for (int e = lookup.nodeOffset[v]; e < lookup.nodeOffset[v + 1]; ++e) {
+                    if (!visited[lookup.neighbour[e]]) {
+                        visited[lookup.neighbour[e]] = true;
+                        neighbours.push_back(lookup.neighbour[e]);
+                    }
+                }
+            }
+
+            std::sort(neighbours.begin(), neighbours.end(),
+                      CompareDegree(degree, false));
+            external.insert(external.end(), neighbours.begin(), neighbours.end());
+        }
+    }
+
+    std::reverse(external.begin(), external.end());
+}
+
+/* Build the runs of consecutive days with contacts of each node. */
+static void
+buildRuns(ContactsLookup& lookup, int n)
+{
+    std::vector<int> days;
+
+    lookup.runOffset.assign(n + 1, 0);
+    lookup.runBegin.clear();
+    lookup.runEnd.clear();
+
+    for (int v = 0; v < n; ++v) {
+        days.assign(lookup.t.begin() + lookup.edgeOffset[lookup.nodeOffset[v]],
+                    lookup.t.begin() + lookup.edgeOffset[lookup.nodeOffset[v + 1]]);
+        std::sort(days.begin(), days.end());
+
+        for (size_t i = 0; i < days.size(); ++i) {
+            if (i > 0 && days[i] <= lookup.runEnd.back() + 1) {
+                lookup.runEnd.back() = days[i];
+            } else {
+                lookup.runBegin.push_back(days[i]);
+                lookup.runEnd.push_back(days[i]);
+            }
+        }
+
+        lookup.runOffset[v + 1] = lookup.runEnd.size();
+    }
+}
+
+/* Build the merged contacts of the nodes with at least
+ * CONTACTS_HUB_DEGREE edges. */
+static void
+buildHubs(ContactsLookup& lookup, int n)
+{
+    std::vector<std::pair<int, int> > contacts;
+
+    lookup.hub.assign(n, -1);
+    lookup.hubs.clear();
+
+    for (int v = 0; v < n; ++v) {
+        int firstEdge = lookup.nodeOffset[v];
+        int degree = lookup.nodeOffset[v + 1] - firstEdge;
+
+        if (degree < CONTACTS_HUB_DEGREE ||
+            lookup.edgeOffset[lookup.nodeOffset[v + 1]] -
+            lookup.edgeOffset[firstEdge] > INT_MAX)
+            continue;
+
+        lookup.hub[v] = lookup.hubs.size();
+        lookup.hubs.push_back(ContactsHub());
+        ContactsHub& hub = lookup.hubs.back();
+        hub.firstEdge = firstEdge;
+
+        /* The contacts of each edge are sorted by t, so the span of
+         * the hub is given by the first and last contact of the
+         * edges. */
+        R_xlen_t first = lookup.edgeOffset[firstEdge];
+        R_xlen_t last = lookup.edgeOffset[lookup.nodeOffset[v + 1]];
+        int tMin = INT_MAX, tMax = INT_MIN;
+        for (int e = firstEdge; e < lookup.nodeOffset[v + 1]; ++e) {
+            tMin = std::min(tMin, *lookup.Begin(e));
+            tMax = std::max(tMax, *(lookup.End(e) - 1));
+        }
+        hub.tMin = tMin;
+        hub.t.resize(last - first);
+        hub.edge.resize(last - first);
+
+        /* Only use a directory by day if it is not much larger than
+         * the contacts. Then the contacts are sorted with a counting
+         * sort on the day. */
+        double span = (double)tMax - (double)tMin + 1.0;
+        if (span <= 4.0 * (last - first) + 366.0) {
+            hub.dayOffset.assign((int)span + 1, 0);
+            for (R_xlen_t i = first; i < last; ++i)
+                hub.dayOffset[lookup.t[i] - tMin + 1]++;
+            for (int d = 0; d < (int)span; ++d)
+                hub.dayOffset[d + 1] += hub.dayOffset[d];
+
+            std::vector<int> offset(hub.dayOffset);
+            for (int e = firstEdge; e < lookup.nodeOffset[v + 1]; ++e) {
+                for (const int *c = lookup.Begin(e); c != lookup.End(e); ++c) {
+                    int j = offset[*c - tMin]++;
+                    hub.t[j] = *c;
+                    hub.edge[j] = e - firstEdge;
+                }
+            }
+        } else {
+            contacts.clear();
+            for (int e = firstEdge; e < lookup.nodeOffset[v + 1]; ++e) {
+                for (const int *c = lookup.Begin(e); c != lookup.End(e); ++c)
+                    contacts.push_back(std::make_pair(*c, e - firstEdge));
+            }
+            std::sort(contacts.begin(), contacts.end());
+
+            for (size_t i = 0; i < contacts.size(); ++i) {
+                hub.t[i] = contacts[i].first;
+                hub.edge[i] = contacts[i].second;
+            }
+        }
+
+        hub.degree = degree;
+    }
+}
+
+void buildContactsCoarse(ContactsLookup& lookup, int width)
+{
+    ContactsCoarse& coarse = lookup.coarse;
+    size_t edges = lookup.neighbour.size();
+
+    coarse.width = width;
+    coarse.edgeOffset.assign(edges + 1, 0);
+    coarse.period.clear();
+
+    /* The contacts of each edge are sorted by t, so the periods are
+     * sorted and the duplicates are adjacent. */
+    for (size_t e = 0; e < edges; ++e) {
+        R_xlen_t first = coarse.period.size();
+
+        for (const int *c = lookup.Begin(e); c != lookup.End(e); ++c) {
+            int p = coarse.Period(*c);
+
+            if ((R_xlen_t)coarse.period.size() == first ||
+                coarse.period.back() != p)
+                coarse.period.push_back(p);
+        }
+
+        coarse.edgeOffset[e + 1] = coarse.period.size();
+    }
+}
+
+bool
+ContactsLookup::ActiveEdges(int node,
+                            int tBegin,
+                            int tEnd,
+                            std::vector<int>& buffer) const
+{
+    if (hub[node] < 0)
+        return false;
+
+    /* The contacts in the window are h.t[lo] to h.t[hi - 1]. */
+    const ContactsHub& h = hubs[hub[node]];
+    int n = h.t.size(), lo, hi;
+    if (tBegin > tEnd) {
+        lo = hi = 0;
+    } else if (h.dayOffset.empty()) {
+        lo = std::lower_bound(h.t.begin(), h.t.end(), tBegin) - h.t.begin();
+        hi = std::upper_bound(h.t.begin(), h.t.end(), tEnd) - h.t.begin();
+    } else {
+        int tMax = h.tMin + (int)h.dayOffset.size() - 2;
+
+        if (tBegin <= h.tMin)
+            lo = 0;
+        else if (tBegin > tMax)
+            lo = n;
+        else
+            lo = h.dayOffset[tBegin - h.tMin];
+
+        if (tEnd < h.tMin)
+            hi = 0;
+        else if (tEnd >= tMax)
+            hi = n;
+        else
+            hi = h.dayOffset[tEnd - h.tMin + 1];
+    }
+
+    /* Search all edges of the hub if the window has more contacts
+     * than the hub has edges. */
+    if (hi - lo > h.degree)
+        return false;
+
+    buffer.clear();
+    for (int i = lo; i < hi; ++i)
+        buffer.push_back(h.firstEdge + h.edge[i]);
+    std::sort(buffer.begin(), buffer.end());
+    buffer.erase(std::unique(buffer.begin(), buffer.end()), buffer.end());
+
+    return true;
+}
+
+/* The rows, sorted by t, with t in the union of the windows. */
+template <typename T>
+static void
+filterRows(std::vector<T>& result,
+           const std::vector<T>& rows,
+           const int *t,
+           const ContactsWindows *windows)
+{
+    if (!windows) {
+        result = rows;
+        return;
+    }
+
+    /* Merge the windows to disjoint intervals sorted by the first
+     * day, to select the rows in one sweep. */
+    ContactsWindows merged;
+    for (size_t i = 0; i < windows->size(); ++i) {
+        if ((*windows)[i].first <= (*windows)[i].second)
+            merged.push_back((*windows)[i]);
+    }
+    std::sort(merged.begin(), merged.end());
+
+    size_t k = 0;
+    for (size_t i = 0; i < merged.size(); ++i) {
+        if (k > 0 && merged[i].first <= merged[k - 1].second)
+            merged[k - 1].second = std::max(merged[k - 1].second, merged[i].second);
+        else
+            merged[k++] = merged[i];
+    }
+    merged.resize(k);
+
+    result.clear();
+    size_t j = 0;
+    for (size_t i = 0; i < rows.size() && j < merged.size(); ++i) {
+        int ti = t[rows[i]];
+
+        while (j < merged.size() && merged[j].second < ti)
+            ++j;
+        if (j < merged.size() && merged[j].first <= ti)
+            result.push_back(rows[i]);
+    }
+}
+
+/* Build the lookups of the contacts in rows, that are sorted by t,
+ * from the zero-based nodes src and dst, see buildContactsIndex. */
+template <typename T>
+static void
+buildLookups(ContactsIndex& index,
+             const std::vector<T>& rows,
+             const int *zb_src,
+             const int *zb_dst,
+             const int *ptr_t,
+             int numberOfIdentifiers,
+             const ContactsWindows *ingoingWindows,
+             const ContactsWindows *outgoingWindows)
+{
+    std::vector<T> selected;
+
+    filterRows(selected, rows, ptr_t, ingoingWindows);
+    buildLookup(index.ingoing, selected, zb_dst, zb_src, ptr_t,
+                numberOfIdentifiers);
+    filterRows(selected, rows, ptr_t, outgoingWindows);
+    buildLookup(index.outgoing, selected, zb_src, zb_dst, ptr_t,
+                numberOfIdentifiers);
+}
+
+/* Build the lookups of the contacts with rows of type T, see
+ * buildContactsIndex. */
+template <typename T>
+static int
+buildLookups(ContactsIndex& index,
+             SEXP src,
+             SEXP dst,
+             SEXP t,
+             int numberOfIdentifiers,
+             const ContactsWindows *ingoingWindows,
+             const ContactsWindows *outgoingWindows)
+{
+    int *ptr_t = INTEGER(t);
+    R_xlen_t len = Rf_xlength(t);
+    std::vector<T> rows(len);
+    std::vector<int> zb_src(len);
+    std::vector<int> zb_dst(len);
+
+    /* The contacts must be sorted by t. R_orderVector is limited to
+     * an int number of rows. */
+    if (len && len <= INT_MAX) {
+        std::vector<int> order(len);
+        R_orderVector(&order[0], len, Rf_lang1(t), FALSE, FALSE);
+        std::copy(order.begin(), order.end(), rows.begin());
+    } else if (len) {
+        for (R_xlen_t i = 0; i < len; ++i)
+            rows[i] = i;
+        std::stable_sort(rows.begin(), rows.end(), CompareTime(ptr_t));
+    }
+
+    /* Decrement with one since C is zero-based. */
+    for (R_xlen_t i = 0; i < len; ++i) {
+        zb_src[i] = INTEGER(src)[i] - 1;
+        zb_dst[i] = INTEGER(dst)[i] - 1;
+        if (zb_src[i] < 0 || zb_src[i] >= numberOfIdentifiers ||
+            zb_dst[i] < 0 || zb_dst[i] >= numberOfIdentifiers)
+            return -1;
+    }
+
+    buildLookups(index, rows, len ? &zb_src[0] : NULL,
+                 len ? &zb_dst[0] : NULL, ptr_t, numberOfIdentifiers,
+                 ingoingWindows, outgoingWindows);
+
+    return 0;
+}
+
+/* Build the lookups of len contacts from the zero-based nodes src
+ * and dst with rows of type T, see buildContactsIndex. */
+template <typename T>
+static int
+buildLookups(ContactsIndex& index,
+             const int *src,
+             const int *dst,
+             const int *t,
+             R_xlen_t len,
+             int numberOfIdentifiers)
+{
+    std::vector<T> rows(len);
+    int tMin = INT_MAX, tMax = INT_MIN;
+
+    for (R_xlen_t i = 0; i < len; ++i) {
+        if (src[i] < 0 || src[i] >= numberOfIdentifiers ||
+            dst[i] < 0 || dst[i] >= numberOfIdentifiers ||
+            t[i] == NA_INTEGER)
+            return -1;
+        if (t[i] < tMin)
+            tMin = t[i];
+        if (t[i] > tMax)
+            tMax = t[i];
+        rows[i] = i;
+    }
+
+    /* Sort the contacts by t, with a counting sort on the day when
+     * the range of days is small compared to the number of
+     * contacts. */
+    if (len && (double)tMax - tMin < 4.0 * len + 1024) {
+        std::vector<int> day(len);
+
+        for (R_xlen_t i = 0; i < len; ++i)
+            day[i] = t[i] - tMin;
+        countingSort(rows, &day[0], tMax - tMin + 1);
+    } else if (len) {
+        std::stable_sort(rows.begin(), rows.end(), CompareTime(t));
+    }
+
+    buildLookups(index, rows, src, dst, t, numberOfIdentifiers, NULL, NULL);
+
+    return 0;
+}
+
+/* Order the nodes of the index and build the runs and hubs of the
+ * lookups, see buildContactsIndex. */
+static int
+finishContactsIndex(ContactsIndex& index, int numberOfIdentifiers, int order)
+{
+    index.external.resize(numberOfIdentifiers);
+    for (int i = 0; i < numberOfIdentifiers; ++i)
+        index.external[i] = i;
+
+    switch (order) {
+    case CONTACTS_ORDER_NONE:
+        break;
+    case CONTACTS_ORDER_DEGREE: {
+        std::vector<R_xlen_t> degree(numberOfIdentifiers);
+
+        for (int v = 0; v < numberOfIdentifiers; ++v) {
+            degree[v] =
+                (index.ingoing.edgeOffset[index.ingoing.nodeOffset[v + 1]] -
+                 index.ingoing.edgeOffset[index.ingoing.nodeOffset[v]]) +
+                (index.outgoing.edgeOffset[index.outgoing.nodeOffset[v + 1]] -
+                 index.outgoing.edgeOffset[index.outgoing.nodeOffset[v]]);
+        }
+
+        std::sort(index.external.begin(), index.external.end(),
+                  CompareDegree(degree, true));
+        break;
+    }
+    case CONTACTS_ORDER_RCM:
+        orderRCM(index.ingoing, index.outgoing, numberOfIdentifiers,
+                 index.external);
+        break;
+    default:
+        return -1;
+    }
+
+    index.internal.resize(numberOfIdentifiers);
+    for (int i = 0; i < numberOfIdentifiers; ++i)
+        index.internal[index.external[i]] = i;
+
+    if (order != CONTACTS_ORDER_NONE) {
+        relabelLookup(index.ingoing, index.internal, index.external);
+        relabelLookup(index.outgoing, index.internal, index.external);
+    }
+
+    buildRuns(index.ingoing, numberOfIdentifiers);
+    buildRuns(index.outgoing, numberOfIdentifiers);
+    buildHubs(index.ingoing, numberOfIdentifiers);
+    buildHubs(index.outgoing, numberOfIdentifiers);
+
+    return 0;
+}
+
+int buildContactsIndex(
+    ContactsIndex& index,
+    SEXP src,
+    SEXP dst,
+    SEXP t,
+    int numberOfIdentifiers,
+    int order,
+    const ContactsWindows *ingoingWindows,
+    const ContactsWindows *outgoingWindows)
+{
+    int error;
+
+    /* Store the rowids in an int unless the data is a long
+     * vector. */
+    index.rows = Rf_xlength(t);
+    if (index.Long()) {
+        error = buildLookups<R_xlen_t>(index, src, dst, t, numberOfIdentifiers,
+                                       ingoingWindows, outgoingWindows);
+    } else {
+        error = buildLookups<int>(index, src, dst, t, numberOfIdentifiers,
+                                  ingoingWindows, outgoingWindows);
+    }
+    if (error)
+        return error;
+
+    return finishContactsIndex(index, numberOfIdentifiers, order);
+}
+
+int buildContactsIndex(
+    ContactsIndex& index,
+    const int *src,
+    const int *dst,
+    const int *t,
+    R_xlen_t len,
+    int numberOfIdentifiers,
+    int order)
+{
+    int error;
+
+    index.rows = len;
+    if (index.Long()) {
+        error = buildLookups<R_xlen_t>(index, src, dst, t, len,
+                                       numberOfIdentifiers);
+    } else {
+        error = buildLookups<int>(index, src, dst, t, len,
+                                  numberOfIdentifiers);
+    }
+    if (error)
+        return error;
+
+    return finishContactsIndex(index, numberOfIdentifiers, order);
+}
+
+/* The binary image of a ContactsIndex, see writeContactsIndex, is a
+ * header of four ints: magic, version, N and order, the number of
+ * rows as an R_xlen_t, then the vectors internal and external, and
+ * for each of ingoing and outgoing: nodeOffset, neighbour,
+ * edgeOffset, t, rowid, longRowid, runOffset, runBegin and runEnd.
+ * Each vector is its length as an R_xlen_t followed by its data. The
+ * hubs are derived from the lookups and rebuilt when the image is
+ * read. The image is in the byte order of the machine, and the magic
+ * number detects an image from a machine with another byte order. */
+#define CONTACTS_INDEX_MAGIC 0x45435443
+#define CONTACTS_INDEX_VERSION 1
+
+/* Help class to write an image to a buffer. */
+class ImageWriter {
+public:
+    template <typename T>
+    void Write(const T& value) {
+        const unsigned char *p = (const unsigned char *)&value;
+        buffer.insert(buffer.end(), p, p + sizeof(T));
+    }
+
+    template <typename T>
+    void Write(const std::vector<T>& vec) {
+        Write((R_xlen_t)vec.size());
+        if (!vec.empty()) {
+            const unsigned char *p = (const unsigned char *)&vec[0];
+            buffer.insert(buffer.end(), p, p + vec.size() * sizeof(T));
+        }
+    }
+
+    std::vector<unsigned char> buffer;
+};
+
+/* Help class to read an image with bounds checks. */
+class ImageReader {
+public:
+    ImageReader(const unsigned char *first, const unsigned char *last)
+        : ptr(first), last(last), error(false)
+        {}
+
+    template <typename T>
+    void Read(T& value) {
+        if (error || (size_t)(last - ptr) < sizeof(T)) {
+            error = true;
+            return;
+        }
+        memcpy(&value, ptr, sizeof(T));
+        ptr += sizeof(T);
+    }
+
+    template <typename T>
+    void Read(std::vector<T>& vec) {
+        R_xlen_t len = -1;
+
+        Read(len);
+        if (error || len < 0 || (size_t)len > (size_t)(last - ptr) / sizeof(T)) {
+            error = true;
+            return;
+        }
+        vec.resize(len);
+        if (len)
+            memcpy(&vec[0], ptr, len * sizeof(T));
+        ptr += len * sizeof(T);
+    }
+
+    /* Check that the whole image was read without errors. */
+    bool Ok(void) const {
+        return !error && ptr == last;
+    }
+
+private:
+    const unsigned char *ptr;
+    const unsigned char *last;
+    bool error;
+};
+
+/* Check that offsets are non-decreasing from zero to last. */
+template <typename T>
+static bool
+validOffsets(const std::vector<T>& offset, size_t len, R_xlen_t last)
+{
+    if (offset.size() != len || offset.empty() || offset[0] != 0 ||
+        offset.back() != last)
+        return false;
+    for (size_t i = 1; i < offset.size(); ++i) {
+        if (offset[i] < offset[i - 1])
+            return false;
+    }
+    return true;
+}
+
+/* Check that the values are in [0, n). */
+template <typename T>
+static bool
+validValues(const std::vector<T>& values, R_xlen_t n)
+{
+    for (size_t i = 0; i < values.size(); ++i) {
+        if (values[i] < 0 || values[i] >= n)
+            return false;
+    }
+    return true;
+}
+
+static void
+writeLookup(ImageWriter& writer, const ContactsLookup& lookup)
+{
+    writer.Write(lookup.nodeOffset);
+    writer.Write(lookup.neighbour);
+    writer.Write(lookup.edgeOffset);
+    writer.Write(lookup.t);
+    writer.Write(lookup.rowid);
+    writer.Write(lookup.longRowid);
+    writer.Write(lookup.runOffset);
+    writer.Write(lookup.runBegin);
+    writer.Write(lookup.runEnd);
+}
+
+static int
+readLookup(ImageReader& reader, ContactsLookup& lookup, int n, R_xlen_t rows)
+{
+    reader.Read(lookup.nodeOffset);
+    reader.Read(lookup.neighbour);
+    reader.Read(lookup.edgeOffset);
+    reader.Read(lookup.t);
+    reader.Read(lookup.rowid);
+    reader.Read(lookup.longRowid);
+    reader.Read(lookup.runOffset);
+    reader.Read(lookup.runBegin);
+    reader.Read(lookup.runEnd);
+
+    size_t edges = lookup.neighbour.size();
+    size_t contacts = lookup.t.size();
+    bool isLong = rows > INT_MAX;
+
+    if (!validOffsets(lookup.nodeOffset, n + 1, edges) ||
+        !validValues(lookup.neighbour, n) ||
+        !validOffsets(lookup.edgeOffset, edges + 1, contacts) ||
+        lookup.rowid.size() != (isLong ? 0 : contacts) ||
+        lookup.longRowid.size() != (isLong ? contacts : 0) ||
+        !validValues(lookup.rowid, rows) ||
+        !validValues(lookup.longRowid, rows) ||
+        !validOffsets(lookup.runOffset, n + 1, lookup.runBegin.size()) ||
+        lookup.runEnd.size() != lookup.runBegin.size())
+        return -1;
+
+    /* An edge has at least one contact, and the contacts of an edge
+     * must be sorted for the searches. */
+    for (size_t e = 0; e < edges; ++e) {
+        if (lookup.edgeOffset[e + 1] == lookup.edgeOffset[e])
+            return -1;
+        for (R_xlen_t i = lookup.edgeOffset[e] + 1; i < lookup.edgeOffset[e + 1]; ++i) {
+            if (lookup.t[i] < lookup.t[i - 1])
+                return -1;
+        }
+    }
+
+    /* The runs are derived from the contacts, so they must be the
+     * runs of the days in t. */
+    std::vector<R_xlen_t> runOffset(lookup.runOffset);
+    std::vector<int> runBegin(lookup.runBegin);
+    std::vector<int> runEnd(lookup.runEnd);
+    buildRuns(lookup, n);
+    if (runOffset != lookup.runOffset ||
+        runBegin != lookup.runBegin ||
+        runEnd != lookup.runEnd)
+        return -1;
+
+    buildHubs(lookup, n);
+
+    return 0;
+}
+
+SEXP writeContactsIndex(const ContactsIndex& index, int order)
+{
+    ImageWriter writer;
+    SEXP image;
+
+    writer.Write((int)CONTACTS_INDEX_MAGIC);
+    writer.Write((int)CONTACTS_INDEX_VERSION);
+    writer.Write(index.N());
+    writer.Write(order);
+    writer.Write(index.rows);
+    writer.Write(index.internal);
+    writer.Write(index.external);
+    writeLookup(writer, index.ingoing);
+    writeLookup(writer, index.outgoing);
+
+    PROTECT(image = Rf_allocVector(RAWSXP, writer.buffer.size()));
+    if (!writer.buffer.empty())
+        memcpy(RAW(image), &writer.buffer[0], writer.buffer.size());
+    UNPROTECT(1);
+
+    return image;
+}
+
+int readContactsIndex(ContactsIndex& index, SEXP image)
+{
+    int magic = 0, version = 0, n = -1, order = -1;
+
+    if (TYPEOF(image) != RAWSXP)
+        return -1;
+
+    ImageReader reader(RAW(image), RAW(image) + XLENGTH(image));
+    reader.Read(magic);
+    reader.Read(version);
+    if (magic != CONTACTS_INDEX_MAGIC || version != CONTACTS_INDEX_VERSION)
+        return -1;
+
+    reader.Read(n);
+    reader.Read(order);
+    reader.Read(index.rows);
+    reader.Read(index.internal);
+    reader.Read(index.external);
+    if (n < 0 || index.rows < 0 ||
+        index.internal.size() != (size_t)n ||
+        index.external.size() != (size_t)n ||
+        !validValues(index.external, n))
+        return -1;
+
+    /* internal must be the inverse permutation of external. */
+    for (int i = 0; i < n; ++i) {
+        if (index.internal[index.external[i]] != i)
+            return -1;
+    }
+
+    if (readLookup(reader, index.ingoing, n, index.rows) ||
+        readLookup(reader, index.outgoing, n, index.rows) ||
+        !reader.Ok())
+        return -1;
+
+    return 0;
+}
+
+SEXP ContactsRowids::Alloc(void) const
+{
+    SEXP vec;
+
+    if (isLong) {
+        vec = Rf_allocVector(REALSXP, longRowid.size());
+        for (size_t i = 0; i < longRowid.size(); ++i)
+            REAL(vec)[i] = longRowid[i];
+    } else {
+        vec = Rf_allocVector(INTSXP, rowid.size());
+        if (!rowid.empty())
+            memcpy(INTEGER(vec), &rowid[0], rowid.size() * sizeof(int));
+    }
+
+    return vec;
+}
+
+int contactsThreads(int threads)
+{
+    int n = threads;
+
+#ifdef _OPENMP
+    if (n == 0)
+        n = omp_get_max_threads();
+#else
+    n = 1;
+#endif
+    if (n < 1)
+        n = 1;
+
+    return n;
+}
+
+/* Build a contacts index of all contacts and return its image, see
+ * writeContactsIndex. */
+extern "C" SEXP contactsIndex(
+    SEXP src,
+    SEXP dst,
+    SEXP t,
+    SEXP numberOfIdentifiers,
+    SEXP order)
+{
+    ContactsIndex index;
+
+    if (Rf_isNull(src) || !Rf_isInteger(src) ||
+        Rf_isNull(dst) || !Rf_isInteger(dst) ||
+        Rf_isNull(t) || !Rf_isInteger(t) ||
+        Rf_xlength(src) != Rf_xlength(dst) ||
+        Rf_xlength(src) != Rf_xlength(t) ||
+        Rf_isNull(numberOfIdentifiers) ||
+        !Rf_isInteger(numberOfIdentifiers) ||
+        Rf_xlength(numberOfIdentifiers) != 1 ||
+        INTEGER(numberOfIdentifiers)[0] < 0 ||
+        Rf_isNull(order) || !Rf_isInteger(order) ||
+        Rf_xlength(order) != 1 ||
+        buildContactsIndex(index, src, dst, t,
+                           INTEGER(numberOfIdentifiers)[0],
+                           INTEGER(order)[0], NULL, NULL))
+        Rf_error("Unable to build contacts index");
+
+    return writeContactsIndex(index, INTEGER(order)[0]);
+}
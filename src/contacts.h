@@ -0,0 +1,461 @@
+/*
+ * Copyright 2013-2020 Stefan Widgren and Maria Noremark,
+ * National Veterinary Institute, Sweden
+ *
+ * Licensed under the EUPL, Version 1.1 or - as soon they
+ * will be approved by the European Commission - subsequent
+ * versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the
+ * Licence.
+ * You may obtain a copy of the Licence at:
+ *
+ * http: *ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in
+ * writing, software distributed under the Licence is
+ * distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the Licence for the specific language governing
+ * permissions and limitations under the Licence.
+ */
+
+#ifndef INCLUDE_CONTACTS_H
+#define INCLUDE_CONTACTS_H
+
+#define R_NO_REMAP
+#define STRICT_R_HEADERS
+
+#include <climits>
+#include <utility>
+#include <vector>
+
+#include <Rinternals.h>
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
+/* Order of the nodes in the contacts index. */
+enum {
+    /* Keep the order of the identifiers. */
+    CONTACTS_ORDER_NONE = 0,
+
+    /* Nodes with many contacts first, so that the hubs that most
+     * traversals pass through are adjacent in memory. */
+    CONTACTS_ORDER_DEGREE = 1,
+
+    /* Reverse Cuthill-McKee order, a breadth-first search of the
+     * contact network such that neighbouring nodes get nearby
+     * positions in memory. */
+    CONTACTS_ORDER_RCM = 2
+};
+
+/* Lists of contacts that are shorter than this are searched with a
+ * linear scan instead of a binary search, see contactsLowerBound. */
+#define CONTACTS_LINEAR_SEARCH 32
+
+/* Count the contacts in [first, last) that are less than value, if
+ * lessEqual is false, or less than or equal to value, if lessEqual
+ * is true. The scan has no branches on the data, and compares four
+ * contacts at a time with SSE2 when available. */
+static inline int
+contactsCount(const int *first, const int *last, int value, bool lessEqual)
+{
+    int n = last - first, i = 0, count = 0;
+
+#if defined(__SSE2__)
+    __m128i v = _mm_set1_epi32(value);
+    __m128i acc = _mm_setzero_si128();
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(first + i));
+
+        /* The lanes of a comparison are -1 if true and 0 if false,
+         * so subtracting them counts the lanes that are true. Count
+         * the contacts greater than value for lessEqual. */
+        if (lessEqual)
+            acc = _mm_sub_epi32(acc, _mm_cmpgt_epi32(x, v));
+        else
+            acc = _mm_sub_epi32(acc, _mm_cmplt_epi32(x, v));
+    }
+
+    int lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    count = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    if (lessEqual)
+        count = i - count;
+#endif
+
+    if (lessEqual) {
+        for (; i < n; ++i)
+            count += first[i] <= value;
+    } else {
+        for (; i < n; ++i)
+            count += first[i] < value;
+    }
+
+    return count;
+}
+
+/* The first contact in the sorted range [first, last) that is not
+ * less than value, or last. Short lists are scanned linearly and
+ * long lists with a branchless binary search, since the branches of
+ * std::lower_bound are hard to predict. */
+static inline const int *
+contactsLowerBound(const int *first, const int *last, int value)
+{
+    int n = last - first;
+
+    if (n < CONTACTS_LINEAR_SEARCH)
+        return first + contactsCount(first, last, value, false);
+
+    while (n > 1) {
+        int half = n / 2;
+        first = (first[half] < value) ? first + half : first;
+        n -= half;
+    }
+
+    return first + (*first < value);
+}
+
+/* The first contact in the sorted range [first, last) that is
+ * greater than value, or last. */
+static inline const int *
+contactsUpperBound(const int *first, const int *last, int value)
+{
+    int n = last - first;
+
+    if (n < CONTACTS_LINEAR_SEARCH)
+        return first + contactsCount(first, last, value, true);
+
+    while (n > 1) {
+        int half = n / 2;
+        first = (first[half] <= value) ? first + half : first;
+        n -= half;
+    }
+
+    return first + (*first <= value);
+}
+
+/* Nodes with at least this number of edges in a direction are hubs,
+ * e.g. markets, see ContactsHub. */
+#define CONTACTS_HUB_DEGREE 64
+
+/* Contacts of a hub merged over all its edges and sorted by t. A
+ * traversal that expands a hub only needs the edges that have
+ * contacts in the time window, which are found from the contacts in
+ * the window instead of searching every edge. */
+class ContactsHub {
+public:
+    /* The first edge of the hub in the lookup. Nodes with more than
+     * INT_MAX contacts are not hubs. */
+    int firstEdge;
+
+    /* The contacts of the hub sorted by t, and the local edge,
+     * i.e. edge - firstEdge, of each contact. */
+    std::vector<int> t;
+    std::vector<int> edge;
+
+    /* Directory of the contacts by day: the contacts on day
+     * tMin + d start at dayOffset[d]. Empty if the contacts span
+     * too many days, then the window is found by binary search. */
+    int tMin;
+    std::vector<int> dayOffset;
+
+    /* The number of edges of the hub. */
+    int degree;
+};
+
+/* The default width in days of the periods of the coarse level of
+ * a lookup, see ContactsCoarse. */
+#define CONTACTS_COARSE_WIDTH 7
+
+/* Coarse level of a lookup with the contacts of each edge aggregated
+ * to periods of width days, e.g. weeks, where period p is the days
+ * p * width to (p + 1) * width - 1. The periods with contacts of
+ * edge e are edgeOffset[e] to edgeOffset[e + 1] - 1, sorted and
+ * without duplicates. The coarse level is derived from the contacts
+ * and only built when a query needs it, see buildContactsCoarse. */
+class ContactsCoarse {
+public:
+    ContactsCoarse() : width(0) {}
+
+    /* The width of the periods, or 0 if the level is not built. */
+    int width;
+    std::vector<R_xlen_t> edgeOffset;
+    std::vector<int> period;
+
+    /* The period of day t, rounded down also for negative days. */
+    int Period(int t) const {
+        return t >= 0 ? t / width : -((width - 1 - t) / width);
+    }
+
+    /* The first period of edge e. */
+    const int *Begin(int e) const {
+        return &period[0] + edgeOffset[e];
+    }
+
+    /* One past the last period of edge e. */
+    const int *End(int e) const {
+        return &period[0] + edgeOffset[e + 1];
+    }
+};
+
+/* Lookup for the contacts in one direction in compressed sparse row
+ * format. The edges from node v, one for each neighbour, are
+ * nodeOffset[v] to nodeOffset[v + 1] - 1, sorted on the identifier
+ * of the neighbour. The contacts of edge e are edgeOffset[e] to
+ * edgeOffset[e + 1] - 1, sorted by t. The number of edges must fit
+ * in an int, but the number of contacts may be a long vector. */
+class ContactsLookup {
+public:
+    std::vector<int> nodeOffset;
+    std::vector<int> neighbour;
+    std::vector<R_xlen_t> edgeOffset;
+    std::vector<int> t;
+
+    /* The zero-based row of each contact. Only one of the vectors is
+     * used: rowid if the rows fit in an int, else longRowid, so that
+     * the rows of a small table take four bytes each. */
+    std::vector<int> rowid;
+    std::vector<R_xlen_t> longRowid;
+
+    /* The first contact of edge e. */
+    const int *Begin(int e) const {
+        return &t[0] + edgeOffset[e];
+    }
+
+    /* One past the last contact of edge e. */
+    const int *End(int e) const {
+        return &t[0] + edgeOffset[e + 1];
+    }
+
+    /* The zero-based row in the data of a contact. */
+    R_xlen_t Rowid(const int *contact) const {
+        if (longRowid.empty())
+            return rowid[contact - &t[0]];
+        return longRowid[contact - &t[0]];
+    }
+
+    /* The days with contacts of each node as runs of consecutive
+     * days: the runs of node v are runOffset[v] to
+     * runOffset[v + 1] - 1, with first day runBegin[r] and last day
+     * runEnd[r], sorted by day. */
+    std::vector<R_xlen_t> runOffset;
+    std::vector<int> runBegin;
+    std::vector<int> runEnd;
+
+    /* Check if node has any contact in [tBegin, tEnd], without
+     * searching its edges. */
+    bool Active(int node, int tBegin, int tEnd) const {
+        if (runOffset[node] == runOffset[node + 1])
+            return false;
+
+        const int *first = &runEnd[0] + runOffset[node];
+        const int *last = &runEnd[0] + runOffset[node + 1];
+        const int *run = contactsLowerBound(first, last, tBegin);
+
+        return run != last && runBegin[run - &runEnd[0]] <= tEnd;
+    }
+
+    /* The index in hubs of each node, or -1 if the node is not a
+     * hub. */
+    std::vector<int> hub;
+    std::vector<ContactsHub> hubs;
+
+    /* The coarse level of the contacts, empty unless built with
+     * buildContactsCoarse. */
+    ContactsCoarse coarse;
+
+    /* Collect the edges of a hub with contacts in [tBegin, tEnd] in
+     * edge order in buffer. Returns false if node is not a hub or
+     * the window is too wide to gain from the hub directory. The
+     * lookup is not modified, so concurrent traversals can share
+     * it, each with its own buffer. */
+    bool ActiveEdges(int node,
+                     int tBegin,
+                     int tEnd,
+                     std::vector<int>& buffer) const;
+};
+
+/* The edges from a node that a traversal in [tBegin, tEnd] needs to
+ * check: none if the node has no contacts in the window, all edges
+ * of the node, or only the active edges of a hub. */
+class ContactsEdges {
+public:
+    ContactsEdges() : first(0), size(0), list(NULL) {}
+
+    ContactsEdges(const ContactsLookup& data,
+                  int node,
+                  int tBegin,
+                  int tEnd)
+        {
+            Reset(data, node, tBegin, tEnd);
+        }
+
+    /* The edges from another node, reusing the buffer. */
+    void Reset(const ContactsLookup& data, int node, int tBegin, int tEnd) {
+        first = data.nodeOffset[node];
+        size = 0;
+        list = NULL;
+
+        if (!data.Active(node, tBegin, tEnd))
+            return;
+
+        if (data.ActiveEdges(node, tBegin, tEnd, buffer)) {
+            size = buffer.size();
+            if (size)
+                list = &buffer[0];
+        } else {
+            size = data.nodeOffset[node + 1] - first;
+        }
+    }
+
+    int Size(void) const {
+        return size;
+    }
+
+    int operator[](int i) const {
+        return list ? list[i] : first + i;
+    }
+
+private:
+    int first;
+    int size;
+    const int *list;
+
+    /* The active edges of a hub. */
+    std::vector<int> buffer;
+
+    /* list can point to buffer, so the edges can't be copied. */
+    ContactsEdges(const ContactsEdges&);
+    ContactsEdges& operator=(const ContactsEdges&);
+};
+
+/* Index of the ingoing and outgoing contacts. The nodes are
+ * relabelled with internal identifiers in the order of the index,
+ * such that nodes that are traversed together are adjacent in
+ * memory. The identifiers that are visible from R are unchanged. */
+class ContactsIndex {
+public:
+    /* The internal identifier of a zero-based identifier. */
+    int Internal(int node) const {
+        return internal[node];
+    }
+
+    /* The zero-based identifier of an internal identifier. */
+    int External(int node) const {
+        return external[node];
+    }
+
+    int N(void) const {
+        return external.size();
+    }
+
+    /* Check if the rows of the data are a long vector, then the
+     * rowids are returned to R as doubles. */
+    bool Long(void) const {
+        return rows > INT_MAX;
+    }
+
+    /* The number of rows in the data. */
+    R_xlen_t rows;
+    std::vector<int> internal;
+    std::vector<int> external;
+    ContactsLookup ingoing;
+    ContactsLookup outgoing;
+};
+
+/* The one-based rowids of the result of a query. The rowids are
+ * held in an int if the rows of the data fit in an int, as in
+ * ContactsLookup, and are only widened to an R_xlen_t for a long
+ * vector. */
+class ContactsRowids {
+public:
+    ContactsRowids() : isLong(false) {}
+
+    /* Forget the rowids, and hold the next rowids in an R_xlen_t if
+     * isLong, see ContactsIndex::Long. */
+    void Clear(bool isLong) {
+        this->isLong = isLong;
+        rowid.clear();
+        longRowid.clear();
+    }
+
+    bool Long(void) const {
+        return isLong;
+    }
+
+    size_t Size(void) const {
+        return isLong ? longRowid.size() : rowid.size();
+    }
+
+    void Push(R_xlen_t value) {
+        if (isLong)
+            longRowid.push_back(value);
+        else
+            rowid.push_back((int)value);
+    }
+
+    R_xlen_t operator[](size_t i) const {
+        return isLong ? longRowid[i] : rowid[i];
+    }
+
+    /* The rowids for R: an integer vector, or a double vector for a
+     * long vector. */
+    SEXP Alloc(void) const;
+
+private:
+    bool isLong;
+    std::vector<int> rowid;
+    std::vector<R_xlen_t> longRowid;
+};
+
+/* Time windows [first, second] of the queries in one direction. */
+typedef std::vector<std::pair<int, int> > ContactsWindows;
+
+/* Build the index of ingoing and outgoing contacts with the nodes in
+ * the specified order, see CONTACTS_ORDER_NONE. Only the contacts
+ * in the union of the windows of a direction are indexed in that
+ * direction, since a traversal never leaves the window of its root.
+ * A NULL window indexes all contacts in that direction. */
+int buildContactsIndex(
+    ContactsIndex& index,
+    SEXP src,
+    SEXP dst,
+    SEXP t,
+    int numberOfIdentifiers,
+    int order,
+    const ContactsWindows *ingoingWindows,
+    const ContactsWindows *outgoingWindows);
+
+/* Build the index of all len contacts from the zero-based nodes src
+ * and dst at t, e.g. from columns that are not R vectors. The
+ * columns are only read during the build. */
+int buildContactsIndex(
+    ContactsIndex& index,
+    const int *src,
+    const int *dst,
+    const int *t,
+    R_xlen_t len,
+    int numberOfIdentifiers,
+    int order);
+
+/* Build the coarse level of the lookup with periods of width days,
+ * see ContactsCoarse. The coarse level is not part of the image of
+ * the index. */
+void buildContactsCoarse(ContactsLookup& lookup, int width);
+
+/* Write the index to a raw vector, e.g. to save it with saveRDS. */
+SEXP writeContactsIndex(const ContactsIndex& index, int order);
+
+/* Read an index from a raw vector from writeContactsIndex. Returns
+ * -1 if the image is not a valid index. */
+int readContactsIndex(ContactsIndex& index, SEXP image);
+
+/* The number of threads from the threads argument of an entry
+ * point: the OpenMP default if 0, and 1 without OpenMP. */
+int contactsThreads(int threads);
+
+#endif
@@ -0,0 +1,252 @@
+/*
+ * Copyright 2013-2020 Stefan Widgren and Maria Noremark,
+ * National Veterinary Institute, Sweden
+ *
+ * Licensed under the EUPL, Version 1.1 or - as soon they
+ * will be approved by the European Commission - subsequent
+ * versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the
+ * Licence.
+ * You may obtain a copy of the Licence at:
+ *
+ * http: *ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in
+ * writing, software distributed under the Licence is
+ * distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the Licence for the specific language governing
+ * permissions and limitations under the Licence.
+ */
+
+
+/*
+ * Greedy selection of the holdings whose combined contact chains
+ * cover the most holdings, e.g. sentinel holdings for surveillance,
+ * see SentinelHoldings in R. A holding covers itself and the
+ * holdings in its ingoing, or outgoing, contact chain.
+ *
+ * The selection is the lazy greedy algorithm (Leskovec et al. 2007):
+ * the marginal gain of a holding can only decrease when other
+ * holdings are selected, so a holding whose gain was evaluated
+ * after the last selection, and is at least the upper bound of the
+ * gain of every other holding, is the next greedy selection. The
+ * first upper bounds are the bounds of the contact chains from the
+ * strongly connected components of the static graph, see topk.cpp,
+ * so the holdings with small contact chains are never traced.
+ *
+ * The contact chains are not stored, but traced again when the gain
+ * of a holding is evaluated, so the memory is linear in the number
+ * of holdings. The holdings with outdated gains at the top of the
+ * queue are evaluated in batches, in parallel with one
+ * ContactsTracer per thread. The contact chain of a selected holding
+ * is reused from the last batches when it is still held there.
+ */
+
+#include "trace.h"
+
+#include <algorithm>
+#include <queue>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* A holding in the queue with an upper bound of its marginal gain,
+ * that is exact if it was evaluated in the current round. The queue
+ * is ordered on decreasing gain, and then on the identifier. */
+struct CoverageCandidate {
+    int gain;
+    int node;
+    int round;
+
+    bool operator<(const CoverageCandidate& other) const {
+        if (gain != other.gain)
+            return gain < other.gain;
+        return node > other.node;
+    }
+};
+
+/* The number of holdings that the root and its contact chain covers
+ * that are not already covered. */
+static int
+coverageGain(ContactsTracer *tracer,
+             int root,
+             int tBegin,
+             int tEnd,
+             bool ingoing,
+             const std::vector<char>& covered,
+             std::vector<int>& chain)
+{
+    int gain = covered[root] ? 0 : 1;
+
+    tracer->ContactChain(root, tBegin, tEnd, ingoing, NULL, &chain);
+    for (size_t i = 0; i < chain.size(); ++i) {
+        if (!covered[chain[i]])
+            gain++;
+    }
+
+    return gain;
+}
+
+/* Select the holdings that cover the most holdings.
+ *
+ * @param image the image of the index.
+ * @param candidate the one-based holdings to select from.
+ * @param ingoing TRUE to cover the ingoing contact chains, FALSE to
+ * cover the outgoing contact chains.
+ * @param tBegin the start of the time window.
+ * @param tEnd the end of the time window.
+ * @param k the number of holdings to select.
+ * @param threads the number of threads, or 0 for the OpenMP default.
+ * @return a list with the one-based node and the marginal gain of
+ * the selected holdings in the order of selection, and traced, the
+ * number of contact chains that were traced.
+ */
+extern "C" SEXP contactsCoverage(
+    SEXP image,
+    SEXP candidate,
+    SEXP ingoing,
+    SEXP tBegin,
+    SEXP tEnd,
+    SEXP k,
+    SEXP threads)
+{
+    const char *names[] = {"node", "gain", "traced", ""};
+    ContactsIndex index;
+    std::vector<ContactsTracer*> tracers;
+    std::vector<std::vector<int> > chains;
+    std::vector<int> chainNode;
+    std::vector<CoverageCandidate> batch;
+    std::vector<int> bound, degree, selected, gains;
+    std::vector<char> covered, queued;
+    std::priority_queue<CoverageCandidate> queue;
+    int n, len, traced = 0;
+    bool in;
+    SEXP result, vec;
+
+    if (!Rf_isInteger(candidate) ||
+        !Rf_isLogical(ingoing) || Rf_xlength(ingoing) != 1 ||
+        LOGICAL(ingoing)[0] == NA_LOGICAL ||
+        !Rf_isInteger(tBegin) || Rf_xlength(tBegin) != 1 ||
+        INTEGER(tBegin)[0] == NA_INTEGER ||
+        !Rf_isInteger(tEnd) || Rf_xlength(tEnd) != 1 ||
+        INTEGER(tEnd)[0] == NA_INTEGER ||
+        !Rf_isInteger(k) || Rf_xlength(k) != 1 ||
+        INTEGER(k)[0] == NA_INTEGER || INTEGER(k)[0] < 0 ||
+        !Rf_isInteger(threads) || Rf_xlength(threads) != 1 ||
+        INTEGER(threads)[0] == NA_INTEGER || INTEGER(threads)[0] < 0 ||
+        readContactsIndex(index, image))
+        Rf_error("Unable to select the holdings");
+
+    for (R_xlen_t i = 0; i < Rf_xlength(candidate); ++i) {
+        if (INTEGER(candidate)[i] == NA_INTEGER ||
+            INTEGER(candidate)[i] < 1 || INTEGER(candidate)[i] > index.N())
+            Rf_error("Unable to select the holdings");
+    }
+
+    in = LOGICAL(ingoing)[0];
+    len = INTEGER(k)[0];
+
+    n = contactsTracers(index, INTEGER(threads)[0], tracers);
+    chains.resize(4 * n);
+
+    /* The holding whose contact chain is in each of the chains, since
+     * a contact chain doesn't depend on the covered holdings. */
+    chainNode.assign(chains.size(), -1);
+
+    /* The first upper bounds of the gains, that are never exact. */
+    topBounds(in ? index.ingoing : index.outgoing, index.N(),
+              INTEGER(tBegin)[0], INTEGER(tEnd)[0], bound, degree);
+    queued.assign(index.N(), 0);
+    for (R_xlen_t i = 0; i < Rf_xlength(candidate); ++i) {
+        int node = INTEGER(candidate)[i] - 1;
+
+        if (queued[node])
+            continue;
+        queued[node] = 1;
+
+        CoverageCandidate c = {bound[index.Internal(node)] + 1, node, -1};
+        queue.push(c);
+    }
+    covered.assign(index.N(), 0);
+
+    while ((int)selected.size() < len && !queue.empty()) {
+        int round = selected.size();
+
+        if (queue.top().round == round) {
+            CoverageCandidate c = queue.top();
+
+            /* No holding can cover any more holdings. */
+            if (c.gain == 0)
+                break;
+
+            queue.pop();
+            selected.push_back(c.node);
+            gains.push_back(c.gain);
+
+            size_t j = std::find(chainNode.begin(), chainNode.end(), c.node) -
+                chainNode.begin();
+            if (j == chains.size()) {
+                j = 0;
+                coverageGain(tracers[0], c.node, INTEGER(tBegin)[0],
+                             INTEGER(tEnd)[0], in, covered, chains[j]);
+                chainNode[j] = c.node;
+                traced++;
+            }
+            covered[c.node] = 1;
+            for (size_t i = 0; i < chains[j].size(); ++i)
+                covered[chains[j][i]] = 1;
+            continue;
+        }
+
+        /* Evaluate the outdated holdings at the top of the queue. */
+        batch.clear();
+        while (!queue.empty() && queue.top().round != round &&
+               batch.size() < chains.size()) {
+            batch.push_back(queue.top());
+            queue.pop();
+        }
+
+#ifdef _OPENMP
+        #pragma omp parallel for num_threads(n) schedule(dynamic, 1)
+#endif
+        for (int i = 0; i < (int)batch.size(); ++i) {
+#ifdef _OPENMP
+            ContactsTracer *tracer = tracers[omp_get_thread_num()];
+#else
+            ContactsTracer *tracer = tracers[0];
+#endif
+
+            batch[i].gain = coverageGain(tracer, batch[i].node,
+                                         INTEGER(tBegin)[0],
+                                         INTEGER(tEnd)[0], in, covered,
+                                         chains[i]);
+            batch[i].round = round;
+        }
+
+        for (size_t i = 0; i < batch.size(); ++i) {
+            chainNode[i] = batch[i].node;
+            queue.push(batch[i]);
+        }
+        traced += batch.size();
+    }
+
+    PROTECT(result = Rf_mkNamed(VECSXP, names));
+    SET_VECTOR_ELT(result, 0, vec = Rf_allocVector(INTSXP, selected.size()));
+    for (size_t i = 0; i < selected.size(); ++i)
+        INTEGER(vec)[i] = selected[i] + 1;
+    SET_VECTOR_ELT(result, 1, vec = Rf_allocVector(INTSXP, gains.size()));
+    for (size_t i = 0; i < gains.size(); ++i)
+        INTEGER(vec)[i] = gains[i];
+    SET_VECTOR_ELT(result, 2, Rf_ScalarInteger(traced));
+
+    for (int i = 0; i < n; ++i)
+        delete tracers[i];
+
+    UNPROTECT(1);
+
+    return result;
+}
@@ -0,0 +1,216 @@
+/*
+ * Copyright 2013-2020 Stefan Widgren and Maria Noremark,
+ * National Veterinary Institute, Sweden
+ *
+ * Licensed under the EUPL, Version 1.1 or - as soon they
+ * will be approved by the European Commission - subsequent
+ * versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the
+ * Licence.
+ * You may obtain a copy of the Licence at:
+ *
+ * http: *ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in
+ * writing, software distributed under the Licence is
+ * distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the Licence for the specific language governing
+ * permissions and limitations under the Licence.
+ */
+
+/*
+ * A cursor over the result of Trace that yields the rows in chunks,
+ * see TraceCursor in R. The cursor holds a prepared index, the
+ * queries and a TraceCursor for the current query, and the rows of
+ * each query are yielded ingoing first, in the same order as from
+ * traceContacts.
+ */
+
+#include "trace.h"
+
+#include <vector>
+
+class ContactsCursor {
+public:
+    ContactsIndex index;
+
+    /* The zero-based roots, or -1 for a root that is not in the
+     * index, and the time windows of the queries. */
+    std::vector<int> root;
+    std::vector<int> inBegin;
+    std::vector<int> inEnd;
+    std::vector<int> outBegin;
+    std::vector<int> outEnd;
+    int maxDistance;
+
+    /* The current query and direction, 2 * query + 1 for outgoing,
+     * and if it is started. */
+    R_xlen_t position;
+    bool started;
+
+    TraceCursor *cursor;
+
+    ContactsCursor() : maxDistance(0), position(0), started(false),
+                       cursor(NULL) {}
+
+    ~ContactsCursor() {
+        delete cursor;
+    }
+};
+
+static void
+cursorFinalizer(SEXP ptr)
+{
+    ContactsCursor *cursor = (ContactsCursor*)R_ExternalPtrAddr(ptr);
+
+    if (cursor) {
+        R_ClearExternalPtr(ptr);
+        delete cursor;
+    }
+}
+
+/* Create a cursor on a prepared index, see ContactsIndex in R.
+ *
+ * @param image the image of the index.
+ * @param root the one-based roots, or 0 for a root that is not in
+ * the index.
+ * @param inBegin the start of the ingoing window of each root.
+ * @param inEnd the end of the ingoing window of each root.
+ * @param outBegin the start of the outgoing window of each root.
+ * @param outEnd the end of the outgoing window of each root.
+ * @param maxDistance the maximum distance to trace, or 0 to trace
+ * all contacts.
+ * @return an external pointer to the cursor.
+ */
+extern "C" SEXP contactsCursor(
+    SEXP image,
+    SEXP root,
+    SEXP inBegin,
+    SEXP inEnd,
+    SEXP outBegin,
+    SEXP outEnd,
+    SEXP maxDistance)
+{
+    ContactsCursor *cursor;
+    R_xlen_t len;
+    SEXP result;
+
+    if (!Rf_isInteger(root) ||
+        !Rf_isInteger(inBegin) || !Rf_isInteger(inEnd) ||
+        !Rf_isInteger(outBegin) || !Rf_isInteger(outEnd) ||
+        Rf_xlength(inBegin) != Rf_xlength(root) ||
+        Rf_xlength(inEnd) != Rf_xlength(root) ||
+        Rf_xlength(outBegin) != Rf_xlength(root) ||
+        Rf_xlength(outEnd) != Rf_xlength(root) ||
+        !Rf_isInteger(maxDistance) || Rf_xlength(maxDistance) != 1 ||
+        INTEGER(maxDistance)[0] == NA_INTEGER ||
+        INTEGER(maxDistance)[0] < 0)
+        Rf_error("Unable to trace contacts");
+
+    cursor = new ContactsCursor();
+    if (readContactsIndex(cursor->index, image)) {
+        delete cursor;
+        Rf_error("Unable to trace contacts");
+    }
+
+    len = Rf_xlength(root);
+    cursor->root.resize(len);
+    for (R_xlen_t i = 0; i < len; ++i) {
+        int node = INTEGER(root)[i];
+        if (node == NA_INTEGER || node < 1 || node > cursor->index.N())
+            cursor->root[i] = -1;
+        else
+            cursor->root[i] = node - 1;
+    }
+    cursor->inBegin.assign(INTEGER(inBegin), INTEGER(inBegin) + len);
+    cursor->inEnd.assign(INTEGER(inEnd), INTEGER(inEnd) + len);
+    cursor->outBegin.assign(INTEGER(outBegin), INTEGER(outBegin) + len);
+    cursor->outEnd.assign(INTEGER(outEnd), INTEGER(outEnd) + len);
+    cursor->maxDistance = INTEGER(maxDistance)[0];
+    cursor->cursor = new TraceCursor(cursor->index, cursor->maxDistance);
+
+    PROTECT(result = R_MakeExternalPtr(cursor, R_NilValue, R_NilValue));
+    R_RegisterCFinalizerEx(result, cursorFinalizer, TRUE);
+    UNPROTECT(1);
+
+    return result;
+}
+
+/* The next rows of a cursor.
+ *
+ * @param ptr the cursor.
+ * @param n the maximum number of rows.
+ * @return a list with index, the one-based query, ingoing, TRUE for
+ * an ingoing contact, rowid, the one-based row of the movements, and
+ * distance. Empty when there are no more rows.
+ */
+extern "C" SEXP contactsCursorNext(SEXP ptr, SEXP n)
+{
+    const char *names[] = {"index", "ingoing", "rowid", "distance", ""};
+    ContactsCursor *cursor = NULL;
+    ContactsRowids rowid;
+    std::vector<int> distance;
+    std::vector<R_xlen_t> position;
+    size_t count;
+    SEXP result, vec;
+
+    if (TYPEOF(ptr) == EXTPTRSXP)
+        cursor = (ContactsCursor*)R_ExternalPtrAddr(ptr);
+    if (!cursor)
+        Rf_error("Invalid cursor");
+    if (!Rf_isInteger(n) || Rf_xlength(n) != 1 ||
+        INTEGER(n)[0] == NA_INTEGER || INTEGER(n)[0] < 1)
+        Rf_error("'n' must be a positive integer");
+
+    count = INTEGER(n)[0];
+    rowid.Clear(cursor->index.Long());
+    while (rowid.Size() < count &&
+           cursor->position < 2 * (R_xlen_t)cursor->root.size()) {
+        R_xlen_t i = cursor->position / 2;
+        bool ingoing = cursor->position % 2 == 0;
+
+        if (!cursor->started) {
+            cursor->started = true;
+            if (cursor->root[i] < 0) {
+                /* A root that is not in the index has no contacts. */
+                cursor->position++;
+                cursor->started = false;
+                continue;
+            }
+
+            if (ingoing) {
+                cursor->cursor->Start(cursor->root[i], cursor->inBegin[i],
+                                      cursor->inEnd[i], true);
+            } else {
+                cursor->cursor->Start(cursor->root[i], cursor->outBegin[i],
+                                      cursor->outEnd[i], false);
+            }
+        }
+
+        size_t added = cursor->cursor->Next(count - rowid.Size(),
+                                            rowid, distance);
+        position.insert(position.end(), added, cursor->position);
+
+        if (cursor->cursor->Done()) {
+            cursor->position++;
+            cursor->started = false;
+        }
+    }
+
+    PROTECT(result = Rf_mkNamed(VECSXP, names));
+    SET_VECTOR_ELT(result, 0, vec = Rf_allocVector(INTSXP, rowid.Size()));
+    for (size_t j = 0; j < rowid.Size(); ++j)
+        INTEGER(vec)[j] = position[j] / 2 + 1;
+    SET_VECTOR_ELT(result, 1, vec = Rf_allocVector(LGLSXP, rowid.Size()));
+    for (size_t j = 0; j < rowid.Size(); ++j)
+        LOGICAL(vec)[j] = position[j] % 2 == 0;
+    SET_VECTOR_ELT(result, 2, rowid.Alloc());
+    SET_VECTOR_ELT(result, 3, vec = Rf_allocVector(INTSXP, distance.size()));
+    for (size_t j = 0; j < distance.size(); ++j)
+        INTEGER(vec)[j] = distance[j];
+    UNPROTECT(1);
+
+    return result;
+}
@@ -0,0 +1,433 @@
+/*
+ * Copyright 2013-2020 Stefan Widgren and Maria Noremark,
+ * National Veterinary Institute, Sweden
+ *
+ * Licensed under the EUPL, Version 1.1 or - as soon they
+ * will be approved by the European Commission - subsequent
+ * versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the
+ * Licence.
+ * You may obtain a copy of the Licence at:
+ *
+ * http: *ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in
+ * writing, software distributed under the Licence is
+ * distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the Licence for the specific language governing
+ * permissions and limitations under the Licence.
+ */
+
+/*
+ * Background jobs that trace the contacts of many roots on a
+ * prepared contacts index without blocking R, see NetworkSummaryJob
+ * and TraceJob in R.
+ *
+ * A job is started on the main thread with a copy of the index and
+ * the queries, and is then traced by a pool of threads that never
+ * use the R API. Each thread has its own ContactsTracer and takes
+ * the next root from a shared counter, so the progress is the
+ * number of traced roots. A cancelled job stops when the threads
+ * have traced their current roots. The result is converted to R
+ * objects on the main thread when it is collected.
+ */
+
+#include "trace.h"
+#include <string.h>
+
+#include <vector>
+
+#define JOB_NETWORK_SUMMARY 1
+#define JOB_TRACE 2
+
+#ifndef _WIN32
+
+#include <pthread.h>
+
+class ContactsJob {
+public:
+    ContactsIndex index;
+    int op;
+    int maxDistance;
+
+    /* The zero-based roots, or -1 for a root that is not in the
+     * index, and the time windows of the queries. */
+    std::vector<int> root;
+    std::vector<int> inBegin;
+    std::vector<int> inEnd;
+    std::vector<int> outBegin;
+    std::vector<int> outEnd;
+
+    /* NETWORK_SUMMARY: four ints for each root. */
+    std::vector<int> summary;
+
+    /* TRACE: the rows and distances of the ingoing and outgoing
+     * contacts of each root. */
+    std::vector<ContactsRowids> rowid;
+    std::vector<std::vector<int> > distance;
+
+    ContactsJob() : op(0), maxDistance(0), next(0), done(0),
+                    running(0), cancelled(false), joined(true) {
+        pthread_mutex_init(&mutex, NULL);
+    }
+
+    ~ContactsJob() {
+        Cancel();
+        Join();
+        pthread_mutex_destroy(&mutex);
+    }
+
+    /* Start the threads. Returns -1 if no thread could be started. */
+    int Start(int threads);
+
+    void Cancel(void) {
+        pthread_mutex_lock(&mutex);
+        cancelled = true;
+        pthread_mutex_unlock(&mutex);
+    }
+
+    /* The number of traced roots, whether the job is cancelled and
+     * the number of running threads. */
+    void Status(R_xlen_t *done, bool *cancelled, int *running) {
+        pthread_mutex_lock(&mutex);
+        *done = this->done;
+        *cancelled = this->cancelled;
+        *running = this->running;
+        pthread_mutex_unlock(&mutex);
+    }
+
+    /* Wait for the threads to exit. */
+    void Join(void) {
+        if (joined)
+            return;
+        for (size_t i = 0; i < threads.size(); ++i)
+            pthread_join(threads[i], NULL);
+        threads.clear();
+        joined = true;
+    }
+
+private:
+    pthread_mutex_t mutex;
+    std::vector<pthread_t> threads;
+    R_xlen_t next;
+    R_xlen_t done;
+    int running;
+    bool cancelled;
+    bool joined;
+
+    void Work(void);
+    void TraceRoot(ContactsTracer& tracer, R_xlen_t i);
+
+    static void* WorkThread(void *arg) {
+        ((ContactsJob*)arg)->Work();
+        return NULL;
+    }
+
+    ContactsJob(const ContactsJob&);
+    ContactsJob& operator=(const ContactsJob&);
+};
+
+int ContactsJob::Start(int n)
+{
+    R_xlen_t len = root.size();
+
+    if (op == JOB_NETWORK_SUMMARY) {
+        summary.resize(4 * len);
+    } else {
+        rowid.resize(2 * len);
+        distance.resize(2 * len);
+        for (R_xlen_t i = 0; i < 2 * len; ++i)
+            rowid[i].Clear(index.Long());
+    }
+
+    joined = false;
+    pthread_mutex_lock(&mutex);
+    for (int i = 0; i < n; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, WorkThread, this))
+            break;
+        threads.push_back(thread);
+        running++;
+    }
+    pthread_mutex_unlock(&mutex);
+
+    return threads.empty() ? -1 : 0;
+}
+
+void ContactsJob::Work(void)
+{
+    ContactsTracer tracer(index);
+
+    for (;;) {
+        R_xlen_t i;
+
+        pthread_mutex_lock(&mutex);
+        if (cancelled || next >= (R_xlen_t)root.size()) {
+            running--;
+            pthread_mutex_unlock(&mutex);
+            return;
+        }
+        i = next++;
+        pthread_mutex_unlock(&mutex);
+
+        TraceRoot(tracer, i);
+
+        pthread_mutex_lock(&mutex);
+        done++;
+        pthread_mutex_unlock(&mutex);
+    }
+}
+
+void ContactsJob::TraceRoot(ContactsTracer& tracer, R_xlen_t i)
+{
+    /* A root that is not in the index has no contacts. */
+    if (root[i] < 0)
+        return;
+
+    if (op == JOB_NETWORK_SUMMARY) {
+        tracer.NetworkSummary(root[i], inBegin[i], inEnd[i],
+                              outBegin[i], outEnd[i], &summary[4 * i]);
+    } else {
+        tracer.Trace(root[i], inBegin[i], inEnd[i], true, maxDistance,
+                     rowid[2 * i], distance[2 * i]);
+        tracer.Trace(root[i], outBegin[i], outEnd[i], false, maxDistance,
+                     rowid[2 * i + 1], distance[2 * i + 1]);
+    }
+}
+
+static void
+jobFinalizer(SEXP ptr)
+{
+    ContactsJob *job = (ContactsJob*)R_ExternalPtrAddr(ptr);
+
+    if (job) {
+        R_ClearExternalPtr(ptr);
+        delete job;
+    }
+}
+
+static ContactsJob*
+jobPointer(SEXP ptr)
+{
+    ContactsJob *job = NULL;
+
+    if (TYPEOF(ptr) == EXTPTRSXP)
+        job = (ContactsJob*)R_ExternalPtrAddr(ptr);
+    if (!job)
+        Rf_error("Invalid job");
+
+    return job;
+}
+
+/* Start a job on a prepared index, see ContactsIndex in R.
+ *
+ * @param image the image of the index.
+ * @param op 1 for a network summary and 2 to trace contacts.
+ * @param root the one-based roots, or 0 for a root that is not in
+ * the index.
+ * @param inBegin the start of the ingoing window of each root.
+ * @param inEnd the end of the ingoing window of each root.
+ * @param outBegin the start of the outgoing window of each root.
+ * @param outEnd the end of the outgoing window of each root.
+ * @param maxDistance the maximum distance to trace, or 0 to trace
+ * all contacts.
+ * @param threads the number of threads, see contactsThreads.
+ * @return an external pointer to the job.
+ */
+extern "C" SEXP contactsJobStart(
+    SEXP image,
+    SEXP op,
+    SEXP root,
+    SEXP inBegin,
+    SEXP inEnd,
+    SEXP outBegin,
+    SEXP outEnd,
+    SEXP maxDistance,
+    SEXP threads)
+{
+    ContactsJob *job;
+    R_xlen_t len;
+    int n;
+    SEXP result;
+
+    if (!Rf_isInteger(op) || Rf_xlength(op) != 1 ||
+        (INTEGER(op)[0] != JOB_NETWORK_SUMMARY &&
+         INTEGER(op)[0] != JOB_TRACE) ||
+        !Rf_isInteger(root) ||
+        !Rf_isInteger(inBegin) || !Rf_isInteger(inEnd) ||
+        !Rf_isInteger(outBegin) || !Rf_isInteger(outEnd) ||
+        Rf_xlength(inBegin) != Rf_xlength(root) ||
+        Rf_xlength(inEnd) != Rf_xlength(root) ||
+        Rf_xlength(outBegin) != Rf_xlength(root) ||
+        Rf_xlength(outEnd) != Rf_xlength(root) ||
+        !Rf_isInteger(maxDistance) || Rf_xlength(maxDistance) != 1 ||
+        INTEGER(maxDistance)[0] == NA_INTEGER ||
+        INTEGER(maxDistance)[0] < 0 ||
+        !Rf_isInteger(threads) || Rf_xlength(threads) != 1 ||
+        INTEGER(threads)[0] == NA_INTEGER || INTEGER(threads)[0] < 0)
+        Rf_error("Unable to start the job");
+
+    job = new ContactsJob();
+    if (readContactsIndex(job->index, image)) {
+        delete job;
+        Rf_error("Unable to start the job");
+    }
+
+    len = Rf_xlength(root);
+    job->op = INTEGER(op)[0];
+    job->maxDistance = INTEGER(maxDistance)[0];
+    job->root.resize(len);
+    for (R_xlen_t i = 0; i < len; ++i) {
+        int node = INTEGER(root)[i];
+        if (node == NA_INTEGER || node < 1 || node > job->index.N())
+            job->root[i] = -1;
+        else
+            job->root[i] = node - 1;
+    }
+    job->inBegin.assign(INTEGER(inBegin), INTEGER(inBegin) + len);
+    job->inEnd.assign(INTEGER(inEnd), INTEGER(inEnd) + len);
+    job->outBegin.assign(INTEGER(outBegin), INTEGER(outBegin) + len);
+    job->outEnd.assign(INTEGER(outEnd), INTEGER(outEnd) + len);
+
+    n = contactsThreads(INTEGER(threads)[0]);
+    if (len < n)
+        n = len > 0 ? len : 1;
+
+    if (job->Start(n)) {
+        delete job;
+        Rf_error("Unable to start the job");
+    }
+
+    PROTECT(result = R_MakeExternalPtr(job, R_NilValue, R_NilValue));
+    R_RegisterCFinalizerEx(result, jobFinalizer, TRUE);
+    UNPROTECT(1);
+
+    return result;
+}
+
+/* The status of a job.
+ *
+ * @return a list with status, "running", "finished" or "cancelled",
+ * done, the number of traced roots, and total, the number of roots.
+ */
+extern "C" SEXP contactsJobStatus(SEXP ptr)
+{
+    const char *names[] = {"status", "done", "total", ""};
+    ContactsJob *job = jobPointer(ptr);
+    R_xlen_t done;
+    bool cancelled;
+    int running;
+    const char *status;
+    SEXP result;
+
+    job->Status(&done, &cancelled, &running);
+    if (running)
+        status = "running";
+    else if (cancelled && done < (R_xlen_t)job->root.size())
+        status = "cancelled";
+    else
+        status = "finished";
+
+    PROTECT(result = Rf_mkNamed(VECSXP, names));
+    SET_VECTOR_ELT(result, 0, Rf_mkString(status));
+    SET_VECTOR_ELT(result, 1, Rf_ScalarReal(done));
+    SET_VECTOR_ELT(result, 2, Rf_ScalarReal(job->root.size()));
+    UNPROTECT(1);
+
+    return result;
+}
+
+/* Cancel a job. The threads stop after their current roots. */
+extern "C" SEXP contactsJobCancel(SEXP ptr)
+{
+    jobPointer(ptr)->Cancel();
+
+    return R_NilValue;
+}
+
+/* Collect the result of a finished job.
+ *
+ * @return for a network summary a list with the integer vectors
+ * inDegree, outDegree, ingoingContactChain and
+ * outgoingContactChain, as from networkSummary. For a trace a list
+ * with the rowids and distances of the ingoing and outgoing
+ * contacts of each root, as from traceContacts.
+ */
+extern "C" SEXP contactsJobResult(SEXP ptr)
+{
+    ContactsJob *job = jobPointer(ptr);
+    R_xlen_t done, len = job->root.size();
+    bool cancelled;
+    int running;
+    SEXP result, vec;
+
+    job->Status(&done, &cancelled, &running);
+    if (!running && cancelled && done < len)
+        Rf_error("The job was cancelled");
+    if (running || done < len)
+        Rf_error("The job is not finished");
+    job->Join();
+
+    if (job->op == JOB_NETWORK_SUMMARY) {
+        const char *names[] = {"inDegree", "outDegree",
+                               "ingoingContactChain",
+                               "outgoingContactChain", ""};
+
+        PROTECT(result = Rf_mkNamed(VECSXP, names));
+        for (int j = 0; j < 4; ++j) {
+            SET_VECTOR_ELT(result, j, vec = Rf_allocVector(INTSXP, len));
+            for (R_xlen_t i = 0; i < len; ++i)
+                INTEGER(vec)[i] = job->summary[4 * i + j];
+        }
+    } else {
+        PROTECT(result = Rf_allocVector(VECSXP, 4 * len));
+        for (R_xlen_t i = 0; i < 2 * len; ++i) {
+            const std::vector<int>& distance = job->distance[i];
+
+            SET_VECTOR_ELT(result, 2 * i, job->rowid[i].Alloc());
+            SET_VECTOR_ELT(result, 2 * i + 1,
+                           vec = Rf_allocVector(INTSXP, distance.size()));
+            if (!distance.empty()) {
+                memcpy(INTEGER(vec), &distance[0],
+                       distance.size() * sizeof(int));
+            }
+        }
+    }
+
+    UNPROTECT(1);
+
+    return result;
+}
+
+#else
+
+extern "C" SEXP contactsJobStart(SEXP image, SEXP op, SEXP root,
+                                 SEXP inBegin, SEXP inEnd,
+                                 SEXP outBegin, SEXP outEnd,
+                                 SEXP maxDistance, SEXP threads)
+{
+    Rf_error("Background jobs are not supported on this platform");
+    return R_NilValue;
+}
+
+extern "C" SEXP contactsJobStatus(SEXP ptr)
+{
+    Rf_error("Background jobs are not supported on this platform");
+    return R_NilValue;
+}
+
+extern "C" SEXP contactsJobCancel(SEXP ptr)
+{
+    Rf_error("Background jobs are not supported on this platform");
+    return R_NilValue;
+}
+
+extern "C" SEXP contactsJobResult(SEXP ptr)
+{
+    Rf_error("Background jobs are not supported on this platform");
+    return R_NilValue;
+}
+
+#endif
@@ -0,0 +1,1129 @@
+/*
+ * Copyright 2013-2020 Stefan Widgren and Maria Noremark,
+ * National Veterinary Institute, Sweden
+ *
+ * Licensed under the EUPL, Version 1.1 or - as soon they
+ * will be approved by the European Commission - subsequent
+ * versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the
+ * Licence.
+ * You may obtain a copy of the Licence at:
+ *
+ * http: *ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in
+ * writing, software distributed under the Licence is
+ * distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the Licence for the specific language governing
+ * permissions and limitations under the Licence.
+ */
+
+/*
+ * Read movements from a delimited text file or from Arrow record
+ * batches straight into a contacts index, without first converting
+ * them to a data.frame.
+ *
+ * The file is read in blocks of complete lines, so the memory used
+ * for the text is bounded by the block size. Each block is split at
+ * line breaks into one chunk per thread, and the chunks are parsed in
+ * parallel: the fields source, destination and t are located, the
+ * dates are converted to days since 1970-01-01 and the identifiers
+ * are hashed. The identifiers are then interned serially in the order
+ * of the file, and the contacts are passed to buildContactsIndex.
+ */
+
+#include "contacts.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+/* The number of bytes to read from the file at a time. */
+#define MOVEMENTS_BLOCK_SIZE (16 << 20)
+
+/* The columns of the file that are used. */
+struct MovementsColumns {
+    int source;
+    int destination;
+    int t;
+};
+
+/* A parsed line with pointers to the identifiers in the block. */
+struct MovementsRecord {
+    const char *src;
+    const char *dst;
+    int srcLen;
+    int dstLen;
+    unsigned int srcHash;
+    unsigned int dstHash;
+    int t;
+};
+
+/* The parsed lines of a chunk of a block. */
+struct MovementsChunk {
+    const char *begin;
+    const char *end;
+    std::vector<MovementsRecord> records;
+    R_xlen_t lines;
+    R_xlen_t errorLine;
+};
+
+/* FNV-1a hash of an identifier. */
+static unsigned int
+hashIdentifier(const char *s, int len)
+{
+    unsigned int h = 2166136261u;
+
+    for (int i = 0; i < len; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+/* Intern the identifiers of the holdings in the order they first
+ * appear, with an open addressing hash table. */
+class MovementsIdentifiers {
+public:
+    std::vector<std::string> names;
+
+    MovementsIdentifiers() : slots(1024, -1), mask(1023) {}
+
+    /* Return the zero-based id of the identifier. */
+    int Intern(const char *s, int len, unsigned int hash) {
+        size_t i = hash & mask;
+
+        for (;;) {
+            int id = slots[i];
+            if (id < 0)
+                break;
+            if (hashes[id] == hash && names[id].size() == (size_t)len &&
+                !memcmp(names[id].data(), s, len))
+                return id;
+            i = (i + 1) & mask;
+        }
+
+        int id = names.size();
+        names.push_back(std::string(s, len));
+        hashes.push_back(hash);
+        slots[i] = id;
+
+        /* Keep the load factor below one half. */
+        if (names.size() * 2 > slots.size())
+            Grow();
+
+        return id;
+    }
+
+private:
+    std::vector<int> slots;
+    std::vector<unsigned int> hashes;
+    size_t mask;
+
+    void Grow() {
+        std::vector<int> tmp(slots.size() * 2, -1);
+
+        mask = tmp.size() - 1;
+        for (size_t id = 0; id < names.size(); ++id) {
+            size_t i = hashes[id] & mask;
+            while (tmp[i] >= 0)
+                i = (i + 1) & mask;
+            tmp[i] = id;
+        }
+
+        slots.swap(tmp);
+    }
+};
+
+/* Locate the next field of a line that starts at p. A field that
+ * starts with a double quote ends at the next double quote, and can
+ * only be followed by blanks before the separator, so a field with an
+ * escaped quote, e.g. "a""b", is invalid. Return a pointer to the
+ * separator after the field, or to the end of the line, or NULL if
+ * the field is invalid. */
+static const char*
+nextField(const char *p,
+          const char *end,
+          char sep,
+          const char **first,
+          const char **last)
+{
+    int quoted = p < end && *p == '"';
+
+    if (quoted) {
+        const char *q = (const char*)memchr(p + 1, '"', end - p - 1);
+        if (!q)
+            return NULL;
+        *first = p + 1;
+        *last = q;
+        for (p = q + 1; p < end && *p != sep; ++p) {
+            if (*p != ' ' && *p != '\t')
+                return NULL;
+        }
+    }
+
+    const char *q = (const char*)memchr(p, sep, end - p);
+    if (!q)
+        q = end;
+    if (!quoted) {
+        *first = p;
+        *last = q;
+    }
+
+    return q;
+}
+
+/* Trim blanks around a field. */
+static void
+trimField(const char **first, const char **last)
+{
+    while (*first < *last && (**first == ' ' || **first == '\t'))
+        ++(*first);
+    while (*last > *first && ((*last)[-1] == ' ' || (*last)[-1] == '\t'))
+        --(*last);
+}
+
+/* Check that a field is not empty or NA. */
+static int
+missingField(const char *first, const char *last)
+{
+    return first == last ||
+        (last - first == 2 && first[0] == 'N' && first[1] == 'A');
+}
+
+/* Convert an ISO 8601 date, YYYY-MM-DD, to the number of days since
+ * 1970-01-01, i.e. the same value as julian of a Date in R. */
+static int
+parseDate(const char *s, const char *last, int *t)
+{
+    static const int days[] = {31, 29, 31, 30, 31, 30,
+                               31, 31, 30, 31, 30, 31};
+    int y, m, d;
+
+    if (last - s != 10 || s[4] != '-' || s[7] != '-')
+        return -1;
+    for (int i = 0; i < 10; ++i) {
+        if (i != 4 && i != 7 && (s[i] < '0' || s[i] > '9'))
+            return -1;
+    }
+
+    y = (s[0] - '0') * 1000 + (s[1] - '0') * 100 +
+        (s[2] - '0') * 10 + (s[3] - '0');
+    m = (s[5] - '0') * 10 + (s[6] - '0');
+    d = (s[8] - '0') * 10 + (s[9] - '0');
+    if (m < 1 || m > 12 || d < 1 || d > days[m - 1] ||
+        (m == 2 && d == 29 && (y % 4 || (y % 100 == 0 && y % 400))))
+        return -1;
+
+    /* Days from the civil date, counted from 0000-03-01. */
+    if (m <= 2)
+        --y;
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    *t = era * 146097 + doe - 719468;
+
+    return 0;
+}
+
+/* Parse one line, without the line break, into a record. Return -1
+ * if a column is missing or invalid. */
+static int
+parseLine(const char *p,
+          const char *end,
+          char sep,
+          const MovementsColumns& columns,
+          MovementsRecord& record)
+{
+    const char *src = NULL, *src_last = NULL;
+    const char *dst = NULL, *dst_last = NULL;
+    const char *t = NULL, *t_last = NULL;
+
+    for (int column = 0; ; ++column) {
+        const char *first, *last;
+
+        p = nextField(p, end, sep, &first, &last);
+        if (!p)
+            return -1;
+        trimField(&first, &last);
+        if (column == columns.source) {
+            src = first;
+            src_last = last;
+        } else if (column == columns.destination) {
+            dst = first;
+            dst_last = last;
+        } else if (column == columns.t) {
+            t = first;
+            t_last = last;
+        }
+
+        if (p == end)
+            break;
+        ++p;
+    }
+
+    if (!src || !dst || !t ||
+        missingField(src, src_last) || missingField(dst, dst_last) ||
+        parseDate(t, t_last, &record.t))
+        return -1;
+
+    record.src = src;
+    record.srcLen = src_last - src;
+    record.srcHash = hashIdentifier(src, record.srcLen);
+    record.dst = dst;
+    record.dstLen = dst_last - dst;
+    record.dstHash = hashIdentifier(dst, record.dstLen);
+
+    return 0;
+}
+
+/* Parse the lines of a chunk. Blank lines are skipped. */
+static void
+parseChunk(MovementsChunk& chunk, char sep, const MovementsColumns& columns)
+{
+    const char *p = chunk.begin;
+
+    chunk.records.clear();
+    chunk.lines = 0;
+    chunk.errorLine = -1;
+
+    while (p < chunk.end) {
+        const char *eol = (const char*)memchr(p, '\n', chunk.end - p);
+        const char *next;
+        MovementsRecord record;
+
+        if (!eol)
+            eol = chunk.end;
+        next = eol < chunk.end ? eol + 1 : eol;
+        if (eol > p && eol[-1] == '\r')
+            --eol;
+
+        if (eol > p) {
+            if (parseLine(p, eol, sep, columns, record)) {
+                chunk.errorLine = chunk.lines;
+                return;
+            }
+            chunk.records.push_back(record);
+        }
+
+        ++chunk.lines;
+        p = next;
+    }
+}
+
+/* Find the columns source, destination and t in the header. */
+static int
+parseHeader(const char *p,
+            const char *end,
+            char sep,
+            MovementsColumns& columns)
+{
+    columns.source = columns.destination = columns.t = -1;
+
+    if (end > p && end[-1] == '\r')
+        --end;
+
+    for (int column = 0; ; ++column) {
+        const char *first, *last;
+
+        p = nextField(p, end, sep, &first, &last);
+        if (!p)
+            return -1;
+        trimField(&first, &last);
+        std::string name(first, last);
+        if (name == "source" && columns.source < 0)
+            columns.source = column;
+        else if (name == "destination" && columns.destination < 0)
+            columns.destination = column;
+        else if (name == "t" && columns.t < 0)
+            columns.t = column;
+
+        if (p == end)
+            break;
+        ++p;
+    }
+
+    if (columns.source < 0 || columns.destination < 0 || columns.t < 0)
+        return -1;
+
+    return 0;
+}
+
+/* Read the movements of a file. Return -1 and a message on error. */
+static int
+readMovements(const char *filename,
+              char sep,
+              int threads,
+              MovementsIdentifiers& identifiers,
+              std::vector<int>& src,
+              std::vector<int>& dst,
+              std::vector<int>& t,
+              char *msg,
+              size_t msgLen)
+{
+    FILE *fp = fopen(filename, "rb");
+    std::vector<char> buffer;
+    std::vector<MovementsChunk> chunks(threads);
+    MovementsColumns columns;
+    size_t used = 0;
+    R_xlen_t line = 1;
+    int header = 1, error = 0;
+
+    if (!fp) {
+        snprintf(msg, msgLen, "Unable to open file '%s'", filename);
+        return -1;
+    }
+
+    for (;;) {
+        buffer.resize(used + MOVEMENTS_BLOCK_SIZE);
+        size_t n = fread(&buffer[used], 1, MOVEMENTS_BLOCK_SIZE, fp);
+        used += n;
+        int eof = n < MOVEMENTS_BLOCK_SIZE;
+
+        if (eof && ferror(fp)) {
+            snprintf(msg, msgLen, "Unable to read file '%s'", filename);
+            error = -1;
+            break;
+        }
+
+        /* Only parse complete lines, unless at the end of the
+         * file. A line longer than the block continues in the next
+         * read. */
+        size_t complete = used;
+        if (!eof) {
+            while (complete > 0 && buffer[complete - 1] != '\n')
+                --complete;
+            if (complete == 0)
+                continue;
+        }
+
+        const char *begin = &buffer[0];
+        const char *end = begin + complete;
+
+        if (header) {
+            const char *eol = (const char*)memchr(begin, '\n', complete);
+            if (!eol)
+                eol = end;
+            if (parseHeader(begin, eol, sep, columns)) {
+                snprintf(msg, msgLen,
+                         "The header must contain the columns "
+                         "source, destination and t");
+                error = -1;
+                break;
+            }
+            begin = eol < end ? eol + 1 : eol;
+            header = 0;
+        }
+
+        /* Split the block at line breaks into one chunk per
+         * thread. */
+        size_t size = (end - begin) / threads;
+        const char *p = begin;
+        for (int i = 0; i < threads; ++i) {
+            const char *q = end;
+            if (i + 1 < threads && p + size < end) {
+                q = (const char*)memchr(p + size, '\n', end - p - size);
+                q = q ? q + 1 : end;
+            }
+            chunks[i].begin = p;
+            chunks[i].end = q;
+            p = q;
+        }
+
+#ifdef _OPENMP
+        #pragma omp parallel for num_threads(threads) schedule(static, 1)
+#endif
+        for (int i = 0; i < threads; ++i)
+            parseChunk(chunks[i], sep, columns);
+
+        for (int i = 0; i < threads && !error; ++i) {
+            const std::vector<MovementsRecord>& records = chunks[i].records;
+
+            if (chunks[i].errorLine >= 0) {
+                snprintf(msg, msgLen, "Invalid movement in line %.0f",
+                         (double)(line + chunks[i].errorLine + 1));
+                error = -1;
+                break;
+            }
+
+            for (size_t j = 0; j < records.size(); ++j) {
+                src.push_back(identifiers.Intern(
+                                  records[j].src, records[j].srcLen,
+                                  records[j].srcHash));
+                dst.push_back(identifiers.Intern(
+                                  records[j].dst, records[j].dstLen,
+                                  records[j].dstHash));
+                t.push_back(records[j].t);
+            }
+
+            line += chunks[i].lines;
+        }
+
+        if (error || eof)
+            break;
+
+        /* Move the incomplete last line to the front. */
+        memmove(&buffer[0], &buffer[complete], used - complete);
+        used -= complete;
+    }
+
+    fclose(fp);
+
+    if (!error && identifiers.names.size() > INT_MAX - 1) {
+        snprintf(msg, msgLen, "Too many holdings in file '%s'", filename);
+        error = -1;
+    }
+
+    return error;
+}
+
+/* Build the contacts index of the movements in a delimited text file
+ * and return a list with the identifiers of the holdings and the
+ * image of the index, see writeContactsIndex. */
+static SEXP
+contactsIndexFileImpl(const char *filename, char sep, int order, int threads,
+                      char *msg, size_t msgLen)
+{
+    MovementsIdentifiers identifiers;
+    ContactsIndex index;
+    std::vector<int> src, dst, t;
+    SEXP result, nodes;
+
+    if (readMovements(filename, sep, threads, identifiers,
+                      src, dst, t, msg, msgLen))
+        return R_NilValue;
+
+    if (buildContactsIndex(index,
+                           src.empty() ? NULL : &src[0],
+                           dst.empty() ? NULL : &dst[0],
+                           t.empty() ? NULL : &t[0],
+                           t.size(), identifiers.names.size(), order)) {
+        snprintf(msg, msgLen, "Unable to build contacts index");
+        return R_NilValue;
+    }
+
+    PROTECT(result = Rf_allocVector(VECSXP, 2));
+    SET_VECTOR_ELT(result, 0, nodes = Rf_allocVector(
+                       STRSXP, identifiers.names.size()));
+    for (size_t i = 0; i < identifiers.names.size(); ++i) {
+        const std::string& name = identifiers.names[i];
+        SET_STRING_ELT(nodes, i, Rf_mkCharLen(name.data(), name.size()));
+    }
+    SET_VECTOR_ELT(result, 1, writeContactsIndex(index, order));
+    UNPROTECT(1);
+
+    return result;
+}
+
+/* Read the movements of a delimited text file into a contacts index,
+ * see contactsIndexFileImpl.
+ *
+ * @param filename the name of the file.
+ * @param sep the field separator.
+ * @param order the order of the holdings in the index.
+ * @param threads the number of threads to parse the file with, or 0
+ * to use the OpenMP default.
+ * @return a list with the identifiers of the holdings and the image
+ * of the index.
+ */
+extern "C" SEXP contactsIndexFile(
+    SEXP filename,
+    SEXP sep,
+    SEXP order,
+    SEXP threads)
+{
+    char msg[512];
+    SEXP result;
+    int n;
+
+    if (!Rf_isString(filename) || Rf_xlength(filename) != 1 ||
+        STRING_ELT(filename, 0) == NA_STRING ||
+        !Rf_isString(sep) || Rf_xlength(sep) != 1 ||
+        STRING_ELT(sep, 0) == NA_STRING ||
+        strlen(CHAR(STRING_ELT(sep, 0))) != 1 ||
+        !Rf_isInteger(order) || Rf_xlength(order) != 1 ||
+        !Rf_isInteger(threads) || Rf_xlength(threads) != 1 ||
+        INTEGER(threads)[0] == NA_INTEGER || INTEGER(threads)[0] < 0)
+        Rf_error("Unable to read movements");
+
+    n = contactsThreads(INTEGER(threads)[0]);
+
+    msg[0] = '\0';
+    result = contactsIndexFileImpl(
+        R_ExpandFileName(Rf_translateChar(STRING_ELT(filename, 0))),
+        CHAR(STRING_ELT(sep, 0))[0], INTEGER(order)[0], n,
+        msg, sizeof(msg));
+    if (Rf_isNull(result))
+        Rf_error("%s", msg);
+
+    return result;
+}
+
+/*
+ * The Arrow C Data Interface, see
+ * https://arrow.apache.org/docs/format/CDataInterface.html
+ *
+ * The structs are part of the ABI and are copied from the
+ * specification, so no Arrow library is needed. A record batch is a
+ * struct array with one child array for each column. The arrays are
+ * owned by the producer, e.g. the arrow or nanoarrow packages, and
+ * are only read here.
+ */
+
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+    /* Array type description */
+    const char *format;
+    const char *name;
+    const char *metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema **children;
+    struct ArrowSchema *dictionary;
+
+    /* Release callback */
+    void (*release)(struct ArrowSchema*);
+    /* Opaque producer-specific data */
+    void *private_data;
+};
+
+struct ArrowArray {
+    /* Array data description */
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void **buffers;
+    struct ArrowArray **children;
+    struct ArrowArray *dictionary;
+
+    /* Release callback */
+    void (*release)(struct ArrowArray*);
+    /* Opaque producer-specific data */
+    void *private_data;
+};
+
+#endif /* ARROW_C_DATA_INTERFACE */
+
+/* A column of ints that points into the buffer of an Arrow array
+ * when the values can be used as they are, and otherwise to a
+ * converted copy. */
+struct ArrowColumn {
+    const int *data;
+    std::vector<int> copy;
+
+    ArrowColumn() : data(NULL) {}
+};
+
+/* Check that an array has the buffers of a layout. */
+static int
+arrowValidArray(const ArrowArray *array, int64_t n_buffers)
+{
+    if (!array || !array->release || array->length < 0 ||
+        array->offset < 0 || array->n_buffers != n_buffers ||
+        (n_buffers && !array->buffers))
+        return 0;
+
+    /* Only the validity bitmap may be missing. */
+    for (int64_t i = 1; i < n_buffers; ++i) {
+        if (!array->buffers[i])
+            return 0;
+    }
+
+    return 1;
+}
+
+/* Check if element i of an array is valid, i.e. not null. */
+static int
+arrowValid(const ArrowArray *array, int64_t i)
+{
+    const unsigned char *bitmap = (const unsigned char*)array->buffers[0];
+
+    if (array->null_count == 0 || !bitmap)
+        return 1;
+    i += array->offset;
+
+    return (bitmap[i >> 3] >> (i & 7)) & 1;
+}
+
+/* Check if the format is an integer type that can index a
+ * dictionary. */
+static int
+arrowIndexFormat(const char *format)
+{
+    return format[0] && !format[1] && strchr("cCsSiIlL", format[0]);
+}
+
+/* Element i of an integer array with format f, see
+ * arrowIndexFormat. */
+static int64_t
+arrowInteger(const ArrowArray *array, char f, int64_t i)
+{
+    const void *p = array->buffers[1];
+
+    i += array->offset;
+    switch (f) {
+    case 'c': return ((const int8_t*)p)[i];
+    case 'C': return ((const uint8_t*)p)[i];
+    case 's': return ((const int16_t*)p)[i];
+    case 'S': return ((const uint16_t*)p)[i];
+    case 'i': return ((const int32_t*)p)[i];
+    case 'I': return ((const uint32_t*)p)[i];
+    case 'l': return ((const int64_t*)p)[i];
+    default: return (int64_t)((const uint64_t*)p)[i];
+    }
+}
+
+/* Intern element i of an identifier array, a string (utf8 or large
+ * utf8) or an integer that is formatted as in as.character. Return
+ * -1 if the element is null or the type is not supported. */
+static int
+arrowIdentifier(const ArrowSchema *schema,
+                const ArrowArray *array,
+                int64_t i,
+                MovementsIdentifiers& identifiers)
+{
+    const char *format = schema->format;
+    const char *s;
+    int64_t len;
+    char buf[32];
+
+    if (!arrowValid(array, i))
+        return -1;
+
+    if (!strcmp(format, "u") || !strcmp(format, "U")) {
+        int64_t j = i + array->offset, first, last;
+
+        if (format[0] == 'u') {
+            first = ((const int32_t*)array->buffers[1])[j];
+            last = ((const int32_t*)array->buffers[1])[j + 1];
+        } else {
+            first = ((const int64_t*)array->buffers[1])[j];
+            last = ((const int64_t*)array->buffers[1])[j + 1];
+        }
+
+        s = (const char*)array->buffers[2] + first;
+        len = last - first;
+        if (len < 0 || len > INT_MAX)
+            return -1;
+    } else if (arrowIndexFormat(format)) {
+        int64_t value = arrowInteger(array, format[0], i);
+
+        if (format[0] == 'L' && value < 0)
+            snprintf(buf, sizeof(buf), "%llu",
+                     (unsigned long long)(uint64_t)value);
+        else
+            snprintf(buf, sizeof(buf), "%lld", (long long)value);
+        s = buf;
+        len = strlen(buf);
+    } else {
+        return -1;
+    }
+
+    if (missingField(s, s + len))
+        return -1;
+
+    return identifiers.Intern(s, len, hashIdentifier(s, len));
+}
+
+/* Mark the dictionary values that are referenced by len indices
+ * from element first of a dictionary encoded array in used, that
+ * has the length of the dictionary. Return -1 if the array is not
+ * valid or an index is null or out of range. */
+static int
+arrowReferenced(const ArrowSchema *schema,
+                const ArrowArray *array,
+                int64_t first,
+                int64_t len,
+                std::vector<char>& used)
+{
+    const ArrowSchema *dictionarySchema = schema->dictionary;
+
+    if (!arrowIndexFormat(schema->format) ||
+        !arrowValidArray(array, 2) ||
+        first + len > array->length ||
+        !arrowValidArray(array->dictionary,
+                         dictionarySchema->format[0] == 'u' ||
+                         dictionarySchema->format[0] == 'U' ? 3 : 2))
+        return -1;
+
+    used.assign(array->dictionary->length, 0);
+    for (int64_t i = 0; i < len; ++i) {
+        int64_t k = arrowInteger(array, schema->format[0], first + i);
+
+        if (!arrowValid(array, first + i) ||
+            k < 0 || k >= array->dictionary->length)
+            return -1;
+        used[k] = 1;
+    }
+
+    return 0;
+}
+
+/* Check if two dictionary encoded arrays share the dictionary. */
+static int
+arrowSameDictionary(const ArrowSchema *schema1,
+                    const ArrowArray *array1,
+                    const ArrowSchema *schema2,
+                    const ArrowArray *array2)
+{
+    const ArrowArray *a = array1->dictionary, *b = array2->dictionary;
+
+    if (a == b)
+        return 1;
+    if (strcmp(schema1->dictionary->format, schema2->dictionary->format) ||
+        a->length != b->length || a->offset != b->offset ||
+        a->n_buffers != b->n_buffers)
+        return 0;
+    for (int64_t i = 1; i < a->n_buffers; ++i) {
+        if (a->buffers[i] != b->buffers[i])
+            return 0;
+    }
+
+    return 1;
+}
+
+/* Import len identifiers from element first of an array. Only the
+ * values of a dictionary that are marked in used, see
+ * arrowReferenced, are interned, in the order of the dictionary. The
+ * indices of a dictionary encoded column are used as they are if
+ * they are int32 and the dictionary maps onto the identifiers in the
+ * same order, e.g. when it is the first column or when source and
+ * destination share the dictionary. */
+static int
+importIdentifiers(ArrowColumn& column,
+                  const ArrowSchema *schema,
+                  const ArrowArray *array,
+                  int64_t first,
+                  int64_t len,
+                  const std::vector<char>& used,
+                  MovementsIdentifiers& identifiers)
+{
+    if (schema->dictionary) {
+        const ArrowArray *dictionary = array->dictionary;
+        int identity = 1;
+
+        std::vector<int> map(dictionary->length, -1);
+        for (int64_t k = 0; k < dictionary->length; ++k) {
+            if (!used[k])
+                continue;
+            map[k] = arrowIdentifier(schema->dictionary, dictionary, k,
+                                     identifiers);
+            if (map[k] < 0)
+                return -1;
+            if (map[k] != k)
+                identity = 0;
+        }
+
+        /* The indices were checked by arrowReferenced. */
+        if (identity && !strcmp(schema->format, "i")) {
+            column.data = (const int*)array->buffers[1] +
+                array->offset + first;
+            return 0;
+        }
+
+        column.copy.resize(len);
+        for (int64_t i = 0; i < len; ++i)
+            column.copy[i] = map[arrowInteger(array, schema->format[0],
+                                              first + i)];
+    } else {
+        if (!arrowValidArray(array, !strcmp(schema->format, "u") ||
+                                    !strcmp(schema->format, "U") ? 3 : 2) ||
+            first + len > array->length)
+            return -1;
+
+        column.copy.resize(len);
+        for (int64_t i = 0; i < len; ++i) {
+            column.copy[i] = arrowIdentifier(schema, array, first + i,
+                                             identifiers);
+            if (column.copy[i] < 0)
+                return -1;
+        }
+    }
+
+    column.data = len ? &column.copy[0] : NULL;
+
+    return 0;
+}
+
+/* Import len days since 1970-01-01 from element first of a date32,
+ * which is used as it is, or a date64 array. */
+static int
+importDays(ArrowColumn& column,
+           const ArrowSchema *schema,
+           const ArrowArray *array,
+           int64_t first,
+           int64_t len)
+{
+    if (!arrowValidArray(array, 2) ||
+        first + len > array->length)
+        return -1;
+
+    for (int64_t i = 0; array->null_count != 0 && i < len; ++i) {
+        if (!arrowValid(array, first + i))
+            return -1;
+    }
+
+    if (!strcmp(schema->format, "tdD")) {
+        column.data = (const int*)array->buffers[1] + array->offset + first;
+        for (int64_t i = 0; i < len; ++i) {
+            if (column.data[i] == NA_INTEGER)
+                return -1;
+        }
+        return 0;
+    }
+
+    if (strcmp(schema->format, "tdm"))
+        return -1;
+
+    column.copy.resize(len);
+    for (int64_t i = 0; i < len; ++i) {
+        int64_t ms = ((const int64_t*)array->buffers[1])[array->offset + first + i];
+        int64_t day = ms / 86400000;
+
+        if (ms % 86400000 < 0)
+            --day;
+        if (day <= INT_MIN || day > INT_MAX)
+            return -1;
+        column.copy[i] = day;
+    }
+    column.data = len ? &column.copy[0] : NULL;
+
+    return 0;
+}
+
+/* Import the columns source, destination and t of a record batch. */
+static int
+importBatch(const ArrowSchema *schema,
+            const ArrowArray *array,
+            MovementsIdentifiers& identifiers,
+            ArrowColumn& src,
+            ArrowColumn& dst,
+            ArrowColumn& t,
+            char *msg,
+            size_t msgLen)
+{
+    int64_t columns[3] = {-1, -1, -1};
+    const char *names[3] = {"source", "destination", "t"};
+    std::vector<char> used[2];
+
+    if (!arrowValidArray(array, 1) || array->n_children != schema->n_children ||
+        (array->n_children && !array->children) || array->null_count > 0) {
+        snprintf(msg, msgLen, "Invalid Arrow record batch");
+        return -1;
+    }
+
+    for (int64_t i = 0; i < schema->n_children; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            if (columns[j] < 0 && schema->children[i]->name &&
+                !strcmp(schema->children[i]->name, names[j]))
+                columns[j] = i;
+        }
+    }
+
+    if (columns[0] < 0 || columns[1] < 0 || columns[2] < 0) {
+        snprintf(msg, msgLen, "The record batch must contain the columns "
+                 "source, destination and t");
+        return -1;
+    }
+
+    /* The offset of the struct array applies to its children. A
+     * dictionary that is shared by source and destination is
+     * interned with the values that either column references, such
+     * that both columns can use the indices as they are. */
+    for (int j = 0; j < 2; ++j) {
+        if (schema->children[columns[j]]->dictionary &&
+            arrowReferenced(schema->children[columns[j]],
+                            array->children[columns[j]], array->offset,
+                            array->length, used[j])) {
+            snprintf(msg, msgLen, "Invalid column %s in record batch",
+                     names[j]);
+            return -1;
+        }
+    }
+
+    if (!used[0].empty() && !used[1].empty() &&
+        arrowSameDictionary(schema->children[columns[0]],
+                            array->children[columns[0]],
+                            schema->children[columns[1]],
+                            array->children[columns[1]])) {
+        for (size_t k = 0; k < used[0].size(); ++k)
+            used[0][k] |= used[1][k];
+    }
+
+    if (importIdentifiers(src, schema->children[columns[0]],
+                          array->children[columns[0]], array->offset,
+                          array->length, used[0], identifiers)) {
+        snprintf(msg, msgLen, "Invalid column source in record batch");
+        return -1;
+    }
+
+    if (importIdentifiers(dst, schema->children[columns[1]],
+                          array->children[columns[1]], array->offset,
+                          array->length, used[1], identifiers)) {
+        snprintf(msg, msgLen, "Invalid column destination in record batch");
+        return -1;
+    }
+
+    if (importDays(t, schema->children[columns[2]],
+                   array->children[columns[2]], array->offset,
+                   array->length)) {
+        snprintf(msg, msgLen, "Invalid column t in record batch, "
+                 "must be date32 or date64 without nulls");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Build the contacts index of the movements in Arrow record batches
+ * and return a list with the identifiers of the holdings and the
+ * image of the index, see writeContactsIndex. The columns of a
+ * single batch are used without copies where possible, while the
+ * columns of several batches are concatenated. */
+static SEXP
+contactsIndexArrowImpl(const ArrowSchema *schema,
+                       const std::vector<const ArrowArray*>& arrays,
+                       int order,
+                       char *msg,
+                       size_t msgLen)
+{
+    MovementsIdentifiers identifiers;
+    ContactsIndex index;
+    std::vector<int> src, dst, t;
+    const int *ptr_src = NULL, *ptr_dst = NULL, *ptr_t = NULL;
+    R_xlen_t len = 0;
+    SEXP result, nodes;
+
+    if (!schema || !schema->release || !schema->format ||
+        strcmp(schema->format, "+s") ||
+        (schema->n_children && !schema->children)) {
+        snprintf(msg, msgLen, "Invalid Arrow schema of record batch");
+        return R_NilValue;
+    }
+
+    /* The schema of a dictionary is checked like a child, and the
+     * values of a dictionary can't be dictionary encoded. */
+    for (int64_t i = 0; i < schema->n_children; ++i) {
+        const ArrowSchema *child = schema->children[i];
+
+        if (!child || !child->format ||
+            (child->dictionary && (!child->dictionary->format ||
+                                   child->dictionary->dictionary))) {
+            snprintf(msg, msgLen, "Invalid Arrow schema of record batch");
+            return R_NilValue;
+        }
+    }
+
+    for (size_t i = 0; i < arrays.size(); ++i) {
+        ArrowColumn batch_src, batch_dst, batch_t;
+
+        if (importBatch(schema, arrays[i], identifiers,
+                        batch_src, batch_dst, batch_t, msg, msgLen))
+            return R_NilValue;
+
+        len = arrays[i]->length;
+        if (arrays.size() == 1) {
+            /* Keep the copies of a single batch alive in src, dst and
+             * t. A swap keeps the data pointers valid. */
+            src.swap(batch_src.copy);
+            dst.swap(batch_dst.copy);
+            t.swap(batch_t.copy);
+            ptr_src = batch_src.data;
+            ptr_dst = batch_dst.data;
+            ptr_t = batch_t.data;
+        } else {
+            src.insert(src.end(), batch_src.data, batch_src.data + len);
+            dst.insert(dst.end(), batch_dst.data, batch_dst.data + len);
+            t.insert(t.end(), batch_t.data, batch_t.data + len);
+        }
+    }
+
+    if (arrays.size() != 1) {
+        len = t.size();
+        ptr_src = src.empty() ? NULL : &src[0];
+        ptr_dst = dst.empty() ? NULL : &dst[0];
+        ptr_t = t.empty() ? NULL : &t[0];
+    }
+
+    if (identifiers.names.size() > INT_MAX - 1 ||
+        buildContactsIndex(index, ptr_src, ptr_dst, ptr_t, len,
+                           identifiers.names.size(), order)) {
+        snprintf(msg, msgLen, "Unable to build contacts index");
+        return R_NilValue;
+    }
+
+    PROTECT(result = Rf_allocVector(VECSXP, 2));
+    SET_VECTOR_ELT(result, 0, nodes = Rf_allocVector(
+                       STRSXP, identifiers.names.size()));
+    for (size_t i = 0; i < identifiers.names.size(); ++i) {
+        const std::string& name = identifiers.names[i];
+        SET_STRING_ELT(nodes, i, Rf_mkCharLen(name.data(), name.size()));
+    }
+    SET_VECTOR_ELT(result, 1, writeContactsIndex(index, order));
+    UNPROTECT(1);
+
+    return result;
+}
+
+/* Build a contacts index of movements in Arrow record batches, see
+ * contactsIndexArrowImpl.
+ *
+ * @param arrays an external pointer to a struct ArrowArray, or a
+ * list of external pointers, with the record batches.
+ * @param schema an external pointer to the struct ArrowSchema of the
+ * record batches.
+ * @param order the order of the holdings in the index.
+ * @return a list with the identifiers of the holdings and the image
+ * of the index.
+ */
+extern "C" SEXP contactsIndexArrow(
+    SEXP arrays,
+    SEXP schema,
+    SEXP order)
+{
+    std::vector<const ArrowArray*> batches;
+    char msg[512];
+    SEXP result;
+
+    if (TYPEOF(schema) != EXTPTRSXP ||
+        !Rf_isInteger(order) || Rf_xlength(order) != 1)
+        Rf_error("Unable to import movements");
+
+    if (TYPEOF(arrays) == EXTPTRSXP) {
+        batches.push_back((const ArrowArray*)R_ExternalPtrAddr(arrays));
+    } else if (TYPEOF(arrays) == VECSXP) {
+        for (R_xlen_t i = 0; i < Rf_xlength(arrays); ++i) {
+            SEXP array = VECTOR_ELT(arrays, i);
+            if (TYPEOF(array) != EXTPTRSXP)
+                Rf_error("Unable to import movements");
+            batches.push_back((const ArrowArray*)R_ExternalPtrAddr(array));
+        }
+    } else {
+        Rf_error("Unable to import movements");
+    }
+
+    msg[0] = '\0';
+    result = contactsIndexArrowImpl(
+        (const ArrowSchema*)R_ExternalPtrAddr(schema), batches,
+        INTEGER(order)[0], msg, sizeof(msg));
+    if (Rf_isNull(result)) {
+        std::vector<const ArrowArray*>().swap(batches);
+        Rf_error("%s", msg);
+    }
+
+    return result;
+}
@@ -0,0 +1,513 @@
+/*
+ * Copyright 2013-2020 Stefan Widgren and Maria Noremark,
+ * National Veterinary Institute, Sweden
+ *
+ * Licensed under the EUPL, Version 1.1 or - as soon they
+ * will be approved by the European Commission - subsequent
+ * versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the
+ * Licence.
+ * You may obtain a copy of the Licence at:
+ *
+ * http: *ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in
+ * writing, software distributed under the Licence is
+ * distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the Licence for the specific language governing
+ * permissions and limitations under the Licence.
+ */
+
+/*
+ * Temporal reachability index in the style of the TTL labelling
+ * (Wu et al., Reachability and time-based path queries in temporal
+ * graphs, ICDE 2016).
+ *
+ * The temporal network is transformed to a static event graph with
+ * one vertex (v, t) for each distinct day t that node v has a
+ * contact. A contact from u to v at t gives the edge (u, t) -> (v, t)
+ * and the vertices of a node are chained in time, (v, t_k) -> (v,
+ * t_k+1). A path in the event graph is then a time-respecting path
+ * in the temporal network, with non-decreasing t as in the contact
+ * chain. The reachability of the event graph is encoded with pruned
+ * 2-hop labels (Yano et al., Fast and scalable reachability queries
+ * on graphs by pruned labeling with landmarks and paths, CIKM 2013):
+ * a vertex a reaches b iff Lout(a) and Lin(b) have a common hub.
+ *
+ * The node y reaches x within [tBegin, tEnd] iff the first vertex of
+ * y with t >= tBegin reaches the last vertex of x with t <= tEnd.
+ * A query is therefore two binary searches and one merge of two
+ * sorted labels.
+ *
+ * The index is stored as one contiguous block of int, so that it can
+ * be kept in an R raw vector and saved with e.g. saveRDS:
+ *
+ *   header[6]: magic, version, nodes (N), vertices (V), Lout
+ *              entries, Lin entries
+ *   vertexOffset[N + 1]: the vertices of node v are vertexOffset[v]
+ *                        to vertexOffset[v + 1] - 1
+ *   vertexTime[V]
+ *   outOffset[V + 1], out[Lout entries]
+ *   inOffset[V + 1], in[Lin entries]
+ *
+ * The build cost is one pruned breadth-first search forwards and one
+ * backwards from each vertex, see ReachabilityLabels::Build for the
+ * order. The searches are pruned at vertices whose reachability is
+ * already covered by the labels of higher ranked hubs, which keeps
+ * them small on networks with a few dominant hubs, e.g. markets. The
+ * size is 4 * (6 + N + 1 + 3 * V + 2 + Lout + Lin) bytes.
+ */
+
+#include "contacts.h"
+#include <string.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#define REACHABILITY_INDEX_MAGIC 0x45435249
+#define REACHABILITY_INDEX_VERSION 1
+#define REACHABILITY_INDEX_HEADER 6
+
+/* Help class to build the labels of the event graph. */
+class ReachabilityLabels {
+public:
+    ReachabilityLabels(const std::vector<int>& forwardOffset,
+                       const std::vector<int>& forward,
+                       const std::vector<int>& backwardOffset,
+                       const std::vector<int>& backward)
+        : forwardOffset(forwardOffset),
+          forward(forward),
+          backwardOffset(backwardOffset),
+          backward(backward),
+          out(forwardOffset.size() - 1),
+          in(forwardOffset.size() - 1),
+          mark(forwardOffset.size() - 1, -1)
+        {}
+
+    /* Rank the vertices on the number of contacts of their node, the
+     * hubs of the temporal network first. The vertices of a node are
+     * ranked in bisection order of time, such that the middle vertex
+     * of a node can cover the paths through both halves of its time
+     * line. */
+    void Build(const std::vector<int>& vertexOffset) {
+        size_t n = out.size();
+        std::vector<std::pair<std::pair<int, int>, int> > order;
+
+        for (size_t node = 0; node + 1 < vertexOffset.size(); ++node) {
+            int first = vertexOffset[node], last = vertexOffset[node + 1];
+            int contacts = (forwardOffset[last] - forwardOffset[first]) +
+                (backwardOffset[last] - backwardOffset[first]);
+
+            Bisect(first, last, 0, -contacts, order);
+        }
+        std::sort(order.begin(), order.end());
+
+        for (size_t rank = 0; rank < n; ++rank) {
+            Search(order[rank].second, (int)rank, true);
+            Search(order[rank].second, (int)rank, false);
+        }
+    }
+
+    const std::vector<std::vector<int> >& Out(void) const {
+        return out;
+    }
+
+    const std::vector<std::vector<int> >& In(void) const {
+        return in;
+    }
+
+private:
+    static void Bisect(int first,
+                       int last,
+                       int depth,
+                       int key,
+                       std::vector<std::pair<std::pair<int, int>, int> >& order) {
+        if (first < last) {
+            int mid = first + (last - first) / 2;
+            order.push_back(std::make_pair(std::make_pair(depth, key), mid));
+            Bisect(first, mid, depth + 1, key, order);
+            Bisect(mid + 1, last, depth + 1, key, order);
+        }
+    }
+
+    /* Pruned breadth-first search from the hub. A backward search
+     * adds the hub to Lout of the vertices that reach it and a
+     * forward search adds the hub to Lin of the vertices it
+     * reaches. */
+    void Search(int hub, int rank, bool backwards) {
+        const std::vector<int>& offset = backwards ? backwardOffset : forwardOffset;
+        const std::vector<int>& edges = backwards ? backward : forward;
+        std::vector<std::vector<int> >& labels = backwards ? out : in;
+        int epoch = 2 * rank + (backwards ? 0 : 1);
+
+        queue.clear();
+        queue.push_back(hub);
+        mark[hub] = epoch;
+
+        for (size_t i = 0; i < queue.size(); ++i) {
+            int v = queue[i];
+
+            if (backwards ? Query(v, hub) : Query(hub, v))
+                continue;
+            labels[v].push_back(rank);
+
+            for (int j = offset[v]; j < offset[v + 1]; ++j) {
+                if (mark[edges[j]] != epoch) {
+                    mark[edges[j]] = epoch;
+                    queue.push_back(edges[j]);
+                }
+            }
+        }
+    }
+
+    bool Query(int a, int b) const {
+        std::vector<int>::const_iterator i = out[a].begin();
+        std::vector<int>::const_iterator j = in[b].begin();
+
+        while (i != out[a].end() && j != in[b].end()) {
+            if (*i == *j)
+                return true;
+            if (*i < *j)
+                ++i;
+            else
+                ++j;
+        }
+
+        return false;
+    }
+
+    const std::vector<int>& forwardOffset;
+    const std::vector<int>& forward;
+    const std::vector<int>& backwardOffset;
+    const std::vector<int>& backward;
+    std::vector<std::vector<int> > out;
+    std::vector<std::vector<int> > in;
+    std::vector<int> mark;
+    std::vector<int> queue;
+};
+
+/* Convert an edge list to compressed sparse rows. */
+static void
+compressEdges(std::vector<std::pair<int, int> >& edges,
+              int n,
+              std::vector<int>& offset,
+              std::vector<int>& to)
+{
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    offset.assign(n + 1, 0);
+    to.resize(edges.size());
+    for (size_t i = 0; i < edges.size(); ++i) {
+        offset[edges[i].first + 1]++;
+        to[i] = edges[i].second;
+    }
+    for (int i = 0; i < n; ++i)
+        offset[i + 1] += offset[i];
+}
+
+/* The vertex of node with time t in the event graph. */
+static int
+eventVertex(const std::vector<int>& vertexOffset,
+            const std::vector<int>& vertexTime,
+            int node,
+            int t)
+{
+    return std::lower_bound(vertexTime.begin() + vertexOffset[node],
+                            vertexTime.begin() + vertexOffset[node + 1],
+                            t) - vertexTime.begin();
+}
+
+extern "C" SEXP reachabilityIndex(
+    SEXP src,
+    SEXP dst,
+    SEXP t,
+    SEXP numberOfIdentifiers)
+{
+    SEXP result;
+    int n;
+
+    if (Rf_isNull(numberOfIdentifiers) ||
+        !Rf_isInteger(numberOfIdentifiers) ||
+        Rf_xlength(numberOfIdentifiers) != 1 ||
+        INTEGER(numberOfIdentifiers)[0] < 0)
+        Rf_error("Unable to build reachability index");
+    n = INTEGER(numberOfIdentifiers)[0];
+
+    /* Lookup for all ingoing and outgoing contacts, in the order of
+     * the identifiers so that the internal and external identifiers
+     * are the same. */
+    ContactsIndex index;
+
+    if (buildContactsIndex(index, src, dst, t, n, CONTACTS_ORDER_NONE,
+                           NULL, NULL))
+        Rf_error("Unable to build reachability index");
+
+    /* The vertices of the event graph, one for each distinct day
+     * that a node has contacts. */
+    std::vector<int> vertexOffset(n + 1, 0);
+    std::vector<int> vertexTime;
+    for (int v = 0; v < n; ++v) {
+        size_t first = vertexTime.size();
+
+        for (int dir = 0; dir < 2; ++dir) {
+            const ContactsLookup& lookup = dir ? index.outgoing : index.ingoing;
+
+            for (int e = lookup.nodeOffset[v]; e < lookup.nodeOffset[v + 1]; ++e)
+                vertexTime.insert(vertexTime.end(), lookup.Begin(e), lookup.End(e));
+        }
+
+        std::sort(vertexTime.begin() + first, vertexTime.end());
+        vertexTime.erase(std::unique(vertexTime.begin() + first,
+                                     vertexTime.end()),
+                         vertexTime.end());
+        vertexOffset[v + 1] = vertexTime.size();
+    }
+    if (vertexTime.size() > INT_MAX)
+        Rf_error("Unable to build reachability index");
+    int nv = vertexTime.size();
+
+    /* The edges of the event graph: contacts between nodes and
+     * waiting at a node until its next contact. */
+    std::vector<std::pair<int, int> > edges;
+    for (int u = 0; u < n; ++u) {
+        for (int j = vertexOffset[u] + 1; j < vertexOffset[u + 1]; ++j)
+            edges.push_back(std::make_pair(j - 1, j));
+
+        const ContactsLookup& lookup = index.outgoing;
+        for (int e = lookup.nodeOffset[u]; e < lookup.nodeOffset[u + 1]; ++e) {
+            if (lookup.neighbour[e] == u)
+                continue;
+
+            for (const int *iit = lookup.Begin(e); iit != lookup.End(e); ++iit) {
+                edges.push_back(std::make_pair(
+                    eventVertex(vertexOffset, vertexTime, u, *iit),
+                    eventVertex(vertexOffset, vertexTime, lookup.neighbour[e], *iit)));
+            }
+        }
+    }
+
+    std::vector<int> forwardOffset, forward, backwardOffset, backward;
+    compressEdges(edges, nv, forwardOffset, forward);
+    for (size_t i = 0; i < edges.size(); ++i)
+        std::swap(edges[i].first, edges[i].second);
+    compressEdges(edges, nv, backwardOffset, backward);
+    std::vector<std::pair<int, int> >().swap(edges);
+
+    ReachabilityLabels labels(forwardOffset, forward, backwardOffset, backward);
+    labels.Build(vertexOffset);
+
+    size_t nout = 0, nin = 0;
+    for (int i = 0; i < nv; ++i) {
+        nout += labels.Out()[i].size();
+        nin += labels.In()[i].size();
+    }
+
+    /* The sizes and offsets are stored as int. */
+    if (nout > INT_MAX || nin > INT_MAX)
+        Rf_error("Unable to build reachability index");
+
+    R_xlen_t len = REACHABILITY_INDEX_HEADER + (n + 1) + nv +
+        2 * (nv + 1) + nout + nin;
+    PROTECT(result = Rf_allocVector(RAWSXP, len * sizeof(int)));
+    int *ptr = (int *)RAW(result);
+
+    *ptr++ = REACHABILITY_INDEX_MAGIC;
+    *ptr++ = REACHABILITY_INDEX_VERSION;
+    *ptr++ = n;
+    *ptr++ = nv;
+    *ptr++ = nout;
+    *ptr++ = nin;
+
+    memcpy(ptr, &vertexOffset[0], (n + 1) * sizeof(int));
+    ptr += n + 1;
+    if (nv)
+        memcpy(ptr, &vertexTime[0], nv * sizeof(int));
+    ptr += nv;
+
+    for (int dir = 0; dir < 2; ++dir) {
+        const std::vector<std::vector<int> >& l = dir ? labels.In() : labels.Out();
+        int *offset = ptr, *entries = ptr + nv + 1;
+
+        offset[0] = 0;
+        for (int i = 0; i < nv; ++i) {
+            if (!l[i].empty())
+                memcpy(entries + offset[i], &l[i][0], l[i].size() * sizeof(int));
+            offset[i + 1] = offset[i] + l[i].size();
+        }
+
+        ptr = entries + offset[nv];
+    }
+
+    UNPROTECT(1);
+
+    return result;
+}
+
+/* Check that the len + 1 offsets start at 0, never decrease and end
+ * at last. */
+static bool
+validReachabilityOffsets(const int *offset, int len, int last)
+{
+    if (offset[0] != 0 || offset[len] != last)
+        return false;
+    for (int i = 0; i < len; ++i) {
+        if (offset[i + 1] < offset[i])
+            return false;
+    }
+    return true;
+}
+
+/* Check that the labels of each of the len vertices are increasing
+ * hubs in [0, len), as required by the merge in Reachable. */
+static bool
+validReachabilityLabels(const int *offset, const int *labels, int len)
+{
+    for (int v = 0; v < len; ++v) {
+        for (int i = offset[v]; i < offset[v + 1]; ++i) {
+            if (labels[i] < 0 || labels[i] >= len ||
+                (i > offset[v] && labels[i] <= labels[i - 1]))
+                return false;
+        }
+    }
+    return true;
+}
+
+/* Read only view of a reachability index in an R raw vector. */
+class ReachabilityIndex {
+public:
+    ReachabilityIndex(SEXP index) {
+        const int *ptr;
+        R_xlen_t len;
+
+        if (TYPEOF(index) != RAWSXP || Rf_xlength(index) % sizeof(int))
+            Rf_error("Invalid reachability index");
+        ptr = (const int *)RAW(index);
+        len = Rf_xlength(index) / sizeof(int);
+
+        if (len < REACHABILITY_INDEX_HEADER ||
+            ptr[0] != REACHABILITY_INDEX_MAGIC ||
+            ptr[1] != REACHABILITY_INDEX_VERSION ||
+            ptr[2] < 0 || ptr[3] < 0 || ptr[4] < 0 || ptr[5] < 0 ||
+            len != REACHABILITY_INDEX_HEADER + (R_xlen_t)ptr[2] + 1 +
+            ptr[3] + 2 * ((R_xlen_t)ptr[3] + 1) + ptr[4] + ptr[5])
+            Rf_error("Invalid reachability index");
+
+        n = ptr[2];
+        vertexOffset = ptr + REACHABILITY_INDEX_HEADER;
+        vertexTime = vertexOffset + n + 1;
+        outOffset = vertexTime + ptr[3];
+        out = outOffset + ptr[3] + 1;
+        inOffset = out + ptr[4];
+        in = inOffset + ptr[3] + 1;
+
+        if (!validReachabilityOffsets(vertexOffset, n, ptr[3]) ||
+            !validReachabilityOffsets(outOffset, ptr[3], ptr[4]) ||
+            !validReachabilityOffsets(inOffset, ptr[3], ptr[5]) ||
+            !validReachabilityLabels(outOffset, out, ptr[3]) ||
+            !validReachabilityLabels(inOffset, in, ptr[3]))
+            Rf_error("Invalid reachability index");
+
+        /* The vertices of a node must be sorted on time for the
+         * binary searches. */
+        for (int v = 0; v < n; ++v) {
+            for (int i = vertexOffset[v] + 1; i < vertexOffset[v + 1]; ++i) {
+                if (vertexTime[i] <= vertexTime[i - 1])
+                    Rf_error("Invalid reachability index");
+            }
+        }
+    }
+
+    int N(void) const {
+        return n;
+    }
+
+    /* Check if there is a time-respecting path from node y to node
+     * x with all contacts within [tBegin, tEnd]. */
+    bool Reachable(int y, int x, int tBegin, int tEnd) const {
+        const int *first, *last;
+        int a, b;
+
+        /* The first vertex of y with t >= tBegin. */
+        first = std::lower_bound(vertexTime + vertexOffset[y],
+                                 vertexTime + vertexOffset[y + 1],
+                                 tBegin);
+        if (first == vertexTime + vertexOffset[y + 1] || *first > tEnd)
+            return false;
+        a = first - vertexTime;
+
+        /* The last vertex of x with t <= tEnd. */
+        last = std::upper_bound(vertexTime + vertexOffset[x],
+                                vertexTime + vertexOffset[x + 1],
+                                tEnd);
+        if (last == vertexTime + vertexOffset[x] || *(last - 1) < tBegin)
+            return false;
+        b = last - 1 - vertexTime;
+
+        const int *i = out + outOffset[a], *iend = out + outOffset[a + 1];
+        const int *j = in + inOffset[b], *jend = in + inOffset[b + 1];
+        while (i != iend && j != jend) {
+            if (*i == *j)
+                return true;
+            if (*i < *j)
+                ++i;
+            else
+                ++j;
+        }
+
+        return false;
+    }
+
+private:
+    int n;
+    const int *vertexOffset;
+    const int *vertexTime;
+    const int *outOffset;
+    const int *out;
+    const int *inOffset;
+    const int *in;
+};
+
+extern "C" SEXP reachable(
+    SEXP index,
+    SEXP source,
+    SEXP destination,
+    SEXP tBegin,
+    SEXP tEnd)
+{
+    SEXP result;
+    ReachabilityIndex reachabilityIndex(index);
+    R_xlen_t len = Rf_xlength(source);
+
+    if (!Rf_isInteger(source) ||
+        !Rf_isInteger(destination) ||
+        !Rf_isInteger(tBegin) ||
+        !Rf_isInteger(tEnd) ||
+        Rf_xlength(destination) != len ||
+        Rf_xlength(tBegin) != len ||
+        Rf_xlength(tEnd) != len)
+        Rf_error("Unable to query reachability index");
+
+    PROTECT(result = Rf_allocVector(LGLSXP, len));
+    for (R_xlen_t i = 0; i < len; ++i) {
+        /* Decrement with one since C is zero-based. */
+        int y = INTEGER(source)[i] - 1;
+        int x = INTEGER(destination)[i] - 1;
+
+        if (y < 0 || y >= reachabilityIndex.N() ||
+            x < 0 || x >= reachabilityIndex.N() ||
+            x == y) {
+            LOGICAL(result)[i] = FALSE;
+        } else {
+            LOGICAL(result)[i] = reachabilityIndex.Reachable(
+                y, x, INTEGER(tBegin)[i], INTEGER(tEnd)[i]);
+        }
+    }
+
+    UNPROTECT(1);
+
+    return result;
+}
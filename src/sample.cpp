@@ -0,0 +1,343 @@
+/*
+ * Copyright 2013-2020 Stefan Widgren and Maria Noremark,
+ * National Veterinary Institute, Sweden
+ *
+ * Licensed under the EUPL, Version 1.1 or - as soon they
+ * will be approved by the European Commission - subsequent
+ * versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the
+ * Licence.
+ * You may obtain a copy of the Licence at:
+ *
+ * http: *ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in
+ * writing, software distributed under the Licence is
+ * distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the Licence for the specific language governing
+ * permissions and limitations under the Licence.
+ */
+
+
+/*
+ * Estimate the distribution of the contact chain sizes of all
+ * holdings from a random sample of roots, see NetworkSummarySample
+ * in R.
+ *
+ * The holdings are stratified on their degree in the time window,
+ * the sum of the in- and out-degree, i.e. the number of distinct
+ * holdings they have contacts with. The holdings without contacts
+ * are not sampled, since their contact chains are empty. The roots
+ * are drawn without replacement in batches with the random number
+ * generator of R on the main thread, and each batch is traced in
+ * parallel with one ContactsTracer per thread. The next batch is
+ * allocated to the strata with the largest reduction of the
+ * variance of the estimated mean. The sampling stops when the
+ * confidence intervals of the mean ingoing and outgoing contact
+ * chain sizes are narrower than the requested width, or when all
+ * holdings are sampled.
+ */
+
+#include "trace.h"
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <R_ext/Random.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* A stratum of holdings with the running mean and variance of the
+ * sampled ingoing and outgoing contact chain sizes. */
+class SampleStratum {
+public:
+    SampleStratum() : drawn(0), n(0) {
+        for (int k = 0; k < 2; ++k) {
+            mean[k] = 0;
+            m2[k] = 0;
+        }
+    }
+
+    void Add(int node) {
+        nodes.push_back(node);
+    }
+
+    size_t N(void) const {
+        return nodes.size();
+    }
+
+    size_t Drawn(void) const {
+        return drawn;
+    }
+
+    /* Draw the next holding without replacement. */
+    int Draw(void) {
+        size_t j = drawn + (size_t)(unif_rand() * (nodes.size() - drawn));
+
+        if (j >= nodes.size())
+            j = nodes.size() - 1;
+        std::swap(nodes[drawn], nodes[j]);
+
+        return nodes[drawn++];
+    }
+
+    /* Add the contact chain sizes of a traced holding. */
+    void Update(int ingoing, int outgoing) {
+        double x[2] = {(double)ingoing, (double)outgoing};
+
+        n++;
+        for (int k = 0; k < 2; ++k) {
+            double delta = x[k] - mean[k];
+            mean[k] += delta / n;
+            m2[k] += delta * (x[k] - mean[k]);
+        }
+    }
+
+    /* The sample variance of the ingoing (0) or outgoing (1)
+     * contact chain sizes. */
+    double Variance(int k) const {
+        return n > 1 ? m2[k] / (n - 1) : 0;
+    }
+
+    /* The variance of the estimated total of the stratum, with the
+     * finite population correction. */
+    double TotalVariance(int k) const {
+        double N = nodes.size();
+
+        if (n >= nodes.size() || n < 2)
+            return 0;
+        return N * N * (1.0 - n / N) * Variance(k) / n;
+    }
+
+    /* The reduction of the variance of the estimated totals if one
+     * more holding is drawn. One is added to the variance, so that a
+     * stratum where the first holdings have the same contact chain
+     * sizes can still be drawn. */
+    double Gain(void) const {
+        double N = nodes.size();
+        double s2 = Variance(0) + Variance(1) + 1.0;
+
+        return N * N * s2 * (1.0 / drawn - 1.0 / (drawn + 1));
+    }
+
+private:
+    /* The first drawn nodes are drawn. */
+    std::vector<int> nodes;
+    size_t drawn;
+    size_t n;
+    double mean[2];
+    double m2[2];
+};
+
+/* The stratum of a holding with the degree, the sum of the in- and
+ * out-degree: 0 for no contacts, otherwise one more than the base
+ * two logarithm. */
+static int
+sampleStratum(int degree)
+{
+    int stratum = 0;
+
+    while (degree > 0) {
+        stratum++;
+        degree >>= 1;
+    }
+
+    return stratum;
+}
+
+/* Sample the contact chain sizes of the holdings in a prepared
+ * index, see ContactsIndex in R.
+ *
+ * @param image the image of the index.
+ * @param inBegin the start of the ingoing window.
+ * @param inEnd the end of the ingoing window.
+ * @param outBegin the start of the outgoing window.
+ * @param outEnd the end of the outgoing window.
+ * @param stratify stratify the holdings on their degree, or sample
+ * all holdings with contacts from one stratum.
+ * @param width the width of the confidence intervals of the means
+ * to stop at.
+ * @param z the quantile of the standard normal distribution for the
+ * confidence level.
+ * @param batch the number of roots to trace between the checks of
+ * the width.
+ * @param threads the number of threads, or 0 for the OpenMP default.
+ * @return a list with node, the one-based sampled holdings, stratum,
+ * the one-based stratum of each sampled holding,
+ * ingoingContactChain and outgoingContactChain of each sampled
+ * holding, size, the number of holdings in each stratum, and zero,
+ * the number of holdings without contacts.
+ */
+extern "C" SEXP networkSummarySample(
+    SEXP image,
+    SEXP inBegin,
+    SEXP inEnd,
+    SEXP outBegin,
+    SEXP outEnd,
+    SEXP stratify,
+    SEXP width,
+    SEXP z,
+    SEXP batch,
+    SEXP threads)
+{
+    const char *names[] = {"node", "stratum", "ingoingContactChain",
+                           "outgoingContactChain", "size", "zero", ""};
+    ContactsIndex index;
+    std::vector<SampleStratum> strata;
+    std::vector<int> node, stratum, ingoing, outgoing;
+    std::vector<ContactsTracer*> tracers;
+    int zero = 0;
+    SEXP result, vec;
+
+    if (!Rf_isInteger(inBegin) || Rf_xlength(inBegin) != 1 ||
+        !Rf_isInteger(inEnd) || Rf_xlength(inEnd) != 1 ||
+        !Rf_isInteger(outBegin) || Rf_xlength(outBegin) != 1 ||
+        !Rf_isInteger(outEnd) || Rf_xlength(outEnd) != 1 ||
+        !Rf_isLogical(stratify) || Rf_xlength(stratify) != 1 ||
+        LOGICAL(stratify)[0] == NA_LOGICAL ||
+        !Rf_isReal(width) || Rf_xlength(width) != 1 ||
+        !R_FINITE(REAL(width)[0]) || REAL(width)[0] < 0 ||
+        !Rf_isReal(z) || Rf_xlength(z) != 1 ||
+        !R_FINITE(REAL(z)[0]) || REAL(z)[0] <= 0 ||
+        !Rf_isInteger(batch) || Rf_xlength(batch) != 1 ||
+        INTEGER(batch)[0] == NA_INTEGER || INTEGER(batch)[0] < 1 ||
+        !Rf_isInteger(threads) || Rf_xlength(threads) != 1 ||
+        INTEGER(threads)[0] == NA_INTEGER || INTEGER(threads)[0] < 0 ||
+        readContactsIndex(index, image))
+        Rf_error("Unable to sample the network summary");
+
+    contactsTracers(index, INTEGER(threads)[0], tracers);
+
+    /* Stratify the holdings. */
+    for (int i = 0; i < index.N(); ++i) {
+        int degree =
+            tracers[0]->Degree(i, INTEGER(inBegin)[0], INTEGER(inEnd)[0],
+                               true) +
+            tracers[0]->Degree(i, INTEGER(outBegin)[0], INTEGER(outEnd)[0],
+                               false);
+
+        if (degree == 0) {
+            zero++;
+        } else {
+            int j = LOGICAL(stratify)[0] ? sampleStratum(degree) - 1 : 0;
+            if (j >= (int)strata.size())
+                strata.resize(j + 1);
+            strata[j].Add(i);
+        }
+    }
+
+    GetRNGstate();
+
+    for (;;) {
+        size_t first = node.size();
+
+        /* Draw at least two holdings from each stratum, to estimate
+         * the variance, and then the holdings with the largest
+         * gain. */
+        for (size_t j = 0; j < strata.size(); ++j) {
+            while (strata[j].Drawn() < 2 && strata[j].Drawn() < strata[j].N()) {
+                node.push_back(strata[j].Draw());
+                stratum.push_back(j);
+            }
+        }
+
+        while (node.size() - first < (size_t)INTEGER(batch)[0]) {
+            int best = -1;
+
+            for (size_t j = 0; j < strata.size(); ++j) {
+                if (strata[j].Drawn() < strata[j].N() &&
+                    (best < 0 || strata[j].Gain() > strata[best].Gain()))
+                    best = j;
+            }
+
+            if (best < 0)
+                break;
+            node.push_back(strata[best].Draw());
+            stratum.push_back(best);
+        }
+
+        if (node.size() == first)
+            break;
+
+        ingoing.resize(node.size());
+        outgoing.resize(node.size());
+
+#ifdef _OPENMP
+        #pragma omp parallel for num_threads((int)tracers.size()) \
+            schedule(dynamic, 16)
+#endif
+        for (int i = first; i < (int)node.size(); ++i) {
+            int summary[4];
+
+#ifdef _OPENMP
+            ContactsTracer *tracer = tracers[omp_get_thread_num()];
+#else
+            ContactsTracer *tracer = tracers[0];
+#endif
+            tracer->NetworkSummary(node[i],
+                                   INTEGER(inBegin)[0], INTEGER(inEnd)[0],
+                                   INTEGER(outBegin)[0], INTEGER(outEnd)[0],
+                                   summary);
+            ingoing[i] = summary[2];
+            outgoing[i] = summary[3];
+        }
+
+        for (size_t i = first; i < node.size(); ++i)
+            strata[stratum[i]].Update(ingoing[i], outgoing[i]);
+
+        /* The width of the confidence interval of the mean of all
+         * holdings in each direction. */
+        bool done = true;
+        for (int k = 0; k < 2; ++k) {
+            double variance = 0;
+
+            for (size_t j = 0; j < strata.size(); ++j)
+                variance += strata[j].TotalVariance(k);
+            variance /= (double)index.N() * index.N();
+
+            if (2.0 * REAL(z)[0] * sqrt(variance) > REAL(width)[0])
+                done = false;
+        }
+
+        if (done)
+            break;
+    }
+
+    PutRNGstate();
+
+    for (size_t i = 0; i < tracers.size(); ++i)
+        delete tracers[i];
+
+    PROTECT(result = Rf_mkNamed(VECSXP, names));
+
+    SET_VECTOR_ELT(result, 0, vec = Rf_allocVector(INTSXP, node.size()));
+    for (size_t i = 0; i < node.size(); ++i)
+        INTEGER(vec)[i] = node[i] + 1;
+
+    SET_VECTOR_ELT(result, 1, vec = Rf_allocVector(INTSXP, stratum.size()));
+    for (size_t i = 0; i < stratum.size(); ++i)
+        INTEGER(vec)[i] = stratum[i] + 1;
+
+    SET_VECTOR_ELT(result, 2, vec = Rf_allocVector(INTSXP, ingoing.size()));
+    for (size_t i = 0; i < ingoing.size(); ++i)
+        INTEGER(vec)[i] = ingoing[i];
+
+    SET_VECTOR_ELT(result, 3, vec = Rf_allocVector(INTSXP, outgoing.size()));
+    for (size_t i = 0; i < outgoing.size(); ++i)
+        INTEGER(vec)[i] = outgoing[i];
+
+    SET_VECTOR_ELT(result, 4, vec = Rf_allocVector(INTSXP, strata.size()));
+    for (size_t j = 0; j < strata.size(); ++j)
+        INTEGER(vec)[j] = strata[j].N();
+
+    SET_VECTOR_ELT(result, 5, Rf_ScalarInteger(zero));
+
+    UNPROTECT(1);
+
+    return result;
+}
@@ -0,0 +1,889 @@
+/*
+ * Copyright 2013-2020 Stefan Widgren and Maria Noremark,
+ * National Veterinary Institute, Sweden
+ *
+ * Licensed under the EUPL, Version 1.1 or - as soon they
+ * will be approved by the European Commission - subsequent
+ * versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the
+ * Licence.
+ * You may obtain a copy of the Licence at:
+ *
+ * http: *ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in
+ * writing, software distributed under the Licence is
+ * distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the Licence for the specific language governing
+ * permissions and limitations under the Licence.
+ */
+
+/*
+ * A server that holds a prepared contacts index in memory and
+ * answers queries from other processes over a Unix domain socket,
+ * and the client to query it, see ContactsServer and ContactsClient
+ * in R.
+ *
+ * The server runs on background threads of the R process that
+ * starts it: one thread accepts connections and a pool of worker
+ * threads serves them, one connection at a time per worker. The
+ * threads never use the R API. Each worker has its own
+ * ContactsTracer, and they share the lookups of the index.
+ *
+ * The protocol is binary with length-prefixed frames. All integers
+ * are in the byte order of the machine, since the client and the
+ * server are on the same machine. A connection can send any number
+ * of requests and gets one response for each request, in order.
+ *
+ * Request: uint32 the number of bytes that follow, int32 op, int32
+ * inBegin, int32 inEnd, int32 outBegin, int32 outEnd, int32
+ * maxDistance and the identifier of the root as the remaining bytes.
+ * Dates are days since 1970-01-01.
+ *
+ * Response: uint32 the number of bytes that follow, int32 status,
+ * 0 on success and -1 on an invalid request, and the result of the
+ * op. For TRACE and SHORTEST_PATHS the ingoing result is followed
+ * by the outgoing result.
+ *
+ * NETWORK_SUMMARY: int32 inDegree, outDegree, ingoingContactChain
+ * and outgoingContactChain.
+ *
+ * TRACE: int32 n, n int64 one-based rows of the movements that the
+ * index was prepared from and n int32 distances.
+ *
+ * SHORTEST_PATHS: int32 n, n int32 distances and n identifiers of
+ * the holdings in the contact chain, each as int32 length and bytes.
+ *
+ * A root that is not in the index has no contacts.
+ */
+
+#include "trace.h"
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#define SERVER_NETWORK_SUMMARY 1
+#define SERVER_TRACE 2
+#define SERVER_SHORTEST_PATHS 3
+
+/* The number of ints before the identifier in a request. */
+#define SERVER_REQUEST_INTS 6
+
+/* The maximum number of bytes in a request. */
+#define SERVER_MAX_REQUEST (1 << 20)
+
+/* The maximum number of bytes in a response, which is only limited
+ * by the length prefix of the frame. */
+#define SERVER_MAX_RESPONSE 0xffffffffu
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <deque>
+#include <set>
+
+#ifdef MSG_NOSIGNAL
+#  define SERVER_SEND_FLAGS MSG_NOSIGNAL
+#else
+#  define SERVER_SEND_FLAGS 0
+#endif
+
+/* Read exactly len bytes. Returns -1 on error or end of file. */
+static int
+readAll(int fd, void *buf, size_t len)
+{
+    char *p = (char*)buf;
+
+    while (len) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* Write exactly len bytes. Returns -1 on error. */
+static int
+writeAll(int fd, const void *buf, size_t len)
+{
+    const char *p = (const char*)buf;
+
+    while (len) {
+        ssize_t n = send(fd, p, len, SERVER_SEND_FLAGS);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* Don't raise SIGPIPE, which would terminate R, when the peer has
+ * closed the connection. */
+static void
+noSigPipe(int fd)
+{
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#else
+    (void)fd;
+#endif
+}
+
+/* Help class to build a frame. */
+class Frame {
+public:
+    std::vector<char> buffer;
+
+    Frame() : buffer(sizeof(uint32_t)) {}
+
+    template <typename T>
+    void Write(const T& value) {
+        const char *p = (const char*)&value;
+        buffer.insert(buffer.end(), p, p + sizeof(T));
+    }
+
+    void Write(const std::string& value) {
+        Write((int32_t)value.size());
+        buffer.insert(buffer.end(), value.begin(), value.end());
+    }
+
+    /* Write the length prefix and send the frame. */
+    int Send(int fd) {
+        if (buffer.size() - sizeof(uint32_t) > SERVER_MAX_RESPONSE)
+            return -1;
+
+        uint32_t len = buffer.size() - sizeof(uint32_t);
+        memcpy(&buffer[0], &len, sizeof(len));
+        return writeAll(fd, &buffer[0], buffer.size());
+    }
+};
+
+/* Read a frame of at most maxLength bytes without the length
+ * prefix. */
+static int
+receiveFrame(int fd, std::vector<char>& frame, uint32_t maxLength)
+{
+    uint32_t len;
+
+    if (readAll(fd, &len, sizeof(len)) || len > maxLength)
+        return -1;
+    frame.resize(len);
+    if (len && readAll(fd, &frame[0], len))
+        return -1;
+
+    return 0;
+}
+
+class ContactsServer {
+public:
+    ContactsIndex index;
+    std::vector<std::string> nodes;
+    std::map<std::string, int> identifiers;
+    std::string path;
+    int fd;
+    int threads;
+
+    ContactsServer() : fd(-1), threads(0), stopping(false), started(0) {
+        pthread_mutex_init(&mutex, NULL);
+        pthread_cond_init(&cond, NULL);
+    }
+
+    ~ContactsServer() {
+        Stop();
+        pthread_cond_destroy(&cond);
+        pthread_mutex_destroy(&mutex);
+    }
+
+    /* Listen on the socket and start the threads. */
+    int Start(char *msg, size_t msgLen);
+
+    /* Stop the threads and remove the socket. */
+    void Stop(void);
+
+private:
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool stopping;
+
+    /* The number of started threads, the acceptor first. */
+    int started;
+    pthread_t acceptor;
+    std::vector<pthread_t> workers;
+
+    /* Accepted connections that wait for a worker and the
+     * connections that are served. */
+    std::deque<int> pending;
+    std::set<int> active;
+
+    bool Stopping(void) {
+        pthread_mutex_lock(&mutex);
+        bool result = stopping;
+        pthread_mutex_unlock(&mutex);
+        return result;
+    }
+
+    void Accept(void);
+    void Work(void);
+    int Serve(ContactsTracer& tracer, int client);
+
+    static void* AcceptThread(void *arg) {
+        ((ContactsServer*)arg)->Accept();
+        return NULL;
+    }
+
+    static void* WorkThread(void *arg) {
+        ((ContactsServer*)arg)->Work();
+        return NULL;
+    }
+};
+
+int ContactsServer::Start(char *msg, size_t msgLen)
+{
+    struct sockaddr_un addr;
+
+    if (path.size() >= sizeof(addr.sun_path)) {
+        snprintf(msg, msgLen, "The socket path is too long");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 ||
+        bind(fd, (struct sockaddr*)&addr, sizeof(addr)) ||
+        listen(fd, 64)) {
+        snprintf(msg, msgLen, "Unable to listen on '%s': %s",
+                 path.c_str(), strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+        return -1;
+    }
+
+    if (pthread_create(&acceptor, NULL, AcceptThread, this)) {
+        snprintf(msg, msgLen, "Unable to start the server");
+        Stop();
+        return -1;
+    }
+    started = 1;
+
+    workers.resize(threads);
+    for (int i = 0; i < threads; ++i) {
+        if (pthread_create(&workers[i], NULL, WorkThread, this)) {
+            snprintf(msg, msgLen, "Unable to start the server");
+            Stop();
+            return -1;
+        }
+        started++;
+    }
+
+    return 0;
+}
+
+void ContactsServer::Stop(void)
+{
+    if (fd < 0)
+        return;
+
+    pthread_mutex_lock(&mutex);
+    stopping = true;
+    for (std::set<int>::iterator it = active.begin(); it != active.end(); ++it)
+        shutdown(*it, SHUT_RDWR);
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+
+    if (started > 0)
+        pthread_join(acceptor, NULL);
+    for (int i = 0; i < started - 1; ++i)
+        pthread_join(workers[i], NULL);
+    started = 0;
+
+    while (!pending.empty()) {
+        close(pending.front());
+        pending.pop_front();
+    }
+
+    close(fd);
+    fd = -1;
+    unlink(path.c_str());
+}
+
+void ContactsServer::Accept(void)
+{
+    struct pollfd p;
+
+    p.fd = fd;
+    p.events = POLLIN;
+
+    /* Poll with a timeout to notice when the server is stopped. */
+    while (!Stopping()) {
+        p.revents = 0;
+        if (poll(&p, 1, 100) <= 0 || !(p.revents & POLLIN))
+            continue;
+
+        int client = accept(fd, NULL, NULL);
+        if (client < 0)
+            continue;
+        noSigPipe(client);
+
+        pthread_mutex_lock(&mutex);
+        if (stopping) {
+            close(client);
+        } else {
+            pending.push_back(client);
+            pthread_cond_signal(&cond);
+        }
+        pthread_mutex_unlock(&mutex);
+    }
+}
+
+void ContactsServer::Work(void)
+{
+    ContactsTracer tracer(index);
+
+    for (;;) {
+        pthread_mutex_lock(&mutex);
+        while (!stopping && pending.empty())
+            pthread_cond_wait(&cond, &mutex);
+        if (stopping) {
+            pthread_mutex_unlock(&mutex);
+            return;
+        }
+        int client = pending.front();
+        pending.pop_front();
+        active.insert(client);
+        pthread_mutex_unlock(&mutex);
+
+        while (!Serve(tracer, client));
+
+        pthread_mutex_lock(&mutex);
+        active.erase(client);
+        pthread_mutex_unlock(&mutex);
+        close(client);
+    }
+}
+
+/* Serve one request. Returns -1 when the connection is done. */
+int ContactsServer::Serve(ContactsTracer& tracer, int client)
+{
+    std::vector<char> request;
+    int32_t q[SERVER_REQUEST_INTS];
+    Frame response;
+
+    if (receiveFrame(client, request, SERVER_MAX_REQUEST))
+        return -1;
+
+    if (request.size() < sizeof(q)) {
+        response.Write((int32_t)-1);
+        response.Send(client);
+        return -1;
+    }
+
+    memcpy(q, &request[0], sizeof(q));
+    std::string root(request.begin() + sizeof(q), request.end());
+    std::map<std::string, int>::const_iterator it = identifiers.find(root);
+    int node = it == identifiers.end() ? -1 : it->second;
+
+    /* Check the days of the request before tracing. */
+    if (q[1] == NA_INTEGER || q[2] == NA_INTEGER ||
+        q[3] == NA_INTEGER || q[4] == NA_INTEGER ||
+        q[1] > q[2] || q[3] > q[4] || q[5] < 0) {
+        response.Write((int32_t)-1);
+        return response.Send(client);
+    }
+
+    switch (q[0]) {
+    case SERVER_NETWORK_SUMMARY: {
+        int result[4] = {0, 0, 0, 0};
+
+        if (node >= 0)
+            tracer.NetworkSummary(node, q[1], q[2], q[3], q[4], result);
+        response.Write((int32_t)0);
+        for (int i = 0; i < 4; ++i)
+            response.Write((int32_t)result[i]);
+        break;
+    }
+    case SERVER_TRACE: {
+        ContactsRowids rowid;
+        std::vector<int> distance;
+
+        response.Write((int32_t)0);
+        for (int ingoing = 1; ingoing >= 0; --ingoing) {
+            if (node >= 0) {
+                tracer.Trace(node, q[ingoing ? 1 : 3], q[ingoing ? 2 : 4],
+                             ingoing, q[5], rowid, distance);
+            }
+            response.Write((int32_t)rowid.Size());
+            for (size_t i = 0; i < rowid.Size(); ++i)
+                response.Write((int64_t)rowid[i]);
+            for (size_t i = 0; i < distance.size(); ++i)
+                response.Write((int32_t)distance[i]);
+        }
+        break;
+    }
+    case SERVER_SHORTEST_PATHS: {
+        std::vector<int> nodes, distance;
+
+        response.Write((int32_t)0);
+        for (int ingoing = 1; ingoing >= 0; --ingoing) {
+            if (node >= 0) {
+                tracer.ShortestPaths(node, q[ingoing ? 1 : 3],
+                                     q[ingoing ? 2 : 4], ingoing,
+                                     nodes, distance);
+            }
+            response.Write((int32_t)nodes.size());
+            for (size_t i = 0; i < distance.size(); ++i)
+                response.Write((int32_t)distance[i]);
+            for (size_t i = 0; i < nodes.size(); ++i)
+                response.Write(this->nodes[nodes[i]]);
+        }
+        break;
+    }
+    default:
+        response.Write((int32_t)-1);
+        break;
+    }
+
+    return response.Send(client);
+}
+
+static void
+serverFinalizer(SEXP ptr)
+{
+    ContactsServer *server = (ContactsServer*)R_ExternalPtrAddr(ptr);
+
+    if (server) {
+        R_ClearExternalPtr(ptr);
+        delete server;
+    }
+}
+
+/* Start a server with the prepared index and the identifiers of its
+ * holdings, see ContactsIndex in R.
+ *
+ * @param image the image of the index.
+ * @param nodes the identifiers of the holdings.
+ * @param path the path of the socket.
+ * @param threads the number of worker threads, see contactsThreads.
+ * @return an external pointer to the server.
+ */
+extern "C" SEXP contactsServerStart(
+    SEXP image,
+    SEXP nodes,
+    SEXP path,
+    SEXP threads)
+{
+    ContactsServer *server;
+    char msg[512];
+    SEXP result;
+
+    if (!Rf_isString(nodes) ||
+        !Rf_isString(path) || Rf_xlength(path) != 1 ||
+        STRING_ELT(path, 0) == NA_STRING ||
+        !Rf_isInteger(threads) || Rf_xlength(threads) != 1 ||
+        INTEGER(threads)[0] == NA_INTEGER || INTEGER(threads)[0] < 0)
+        Rf_error("Unable to start the server");
+
+    server = new ContactsServer();
+    if (readContactsIndex(server->index, image) ||
+        server->index.N() != Rf_xlength(nodes)) {
+        delete server;
+        Rf_error("Unable to start the server");
+    }
+
+    for (R_xlen_t i = 0; i < Rf_xlength(nodes); ++i) {
+        server->nodes.push_back(CHAR(STRING_ELT(nodes, i)));
+        server->identifiers[server->nodes.back()] = i;
+    }
+
+    server->path = R_ExpandFileName(Rf_translateChar(STRING_ELT(path, 0)));
+    server->threads = contactsThreads(INTEGER(threads)[0]);
+
+    msg[0] = '\0';
+    if (server->Start(msg, sizeof(msg))) {
+        delete server;
+        Rf_error("%s", msg);
+    }
+
+    PROTECT(result = R_MakeExternalPtr(server, R_NilValue, R_NilValue));
+    R_RegisterCFinalizerEx(result, serverFinalizer, TRUE);
+    UNPROTECT(1);
+
+    return result;
+}
+
+/* Stop a server, see contactsServerStart. */
+extern "C" SEXP contactsServerStop(SEXP ptr)
+{
+    if (TYPEOF(ptr) != EXTPTRSXP)
+        Rf_error("Invalid server");
+    serverFinalizer(ptr);
+
+    return R_NilValue;
+}
+
+/* Help class to read a response. */
+class ResponseReader {
+public:
+    ResponseReader(const std::vector<char>& frame)
+        : p(frame.empty() ? NULL : &frame[0]),
+          end(p + frame.size()),
+          ok(true)
+        {}
+
+    template <typename T>
+    T Read(void) {
+        T value = T();
+
+        if (end - p < (ptrdiff_t)sizeof(T)) {
+            ok = false;
+        } else {
+            memcpy(&value, p, sizeof(T));
+            p += sizeof(T);
+        }
+
+        return value;
+    }
+
+    SEXP ReadString(void) {
+        int32_t len = Read<int32_t>();
+
+        if (!ok || len < 0 || end - p < len) {
+            ok = false;
+            return NA_STRING;
+        }
+        p += len;
+
+        return Rf_mkCharLen(p - len, len);
+    }
+
+    /* Skip a string without creating it. */
+    void SkipString(void) {
+        int32_t len = Read<int32_t>();
+
+        if (!ok || len < 0 || end - p < len)
+            ok = false;
+        else
+            p += len;
+    }
+
+    bool Ok(void) const {
+        return ok;
+    }
+
+private:
+    const char *p;
+    const char *end;
+    bool ok;
+};
+
+/* Connect to the socket of a server. Returns -1 on error. */
+static int
+connectServer(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+    noSigPipe(fd);
+
+    return fd;
+}
+
+/* Send the queries of a call and receive the responses into frames,
+ * over one connection. */
+static int
+queryServer(const char *path,
+            int op,
+            SEXP root,
+            SEXP inBegin,
+            SEXP inEnd,
+            SEXP outBegin,
+            SEXP outEnd,
+            int maxDistance,
+            std::vector<std::vector<char> >& frames)
+{
+    int fd = connectServer(path), error = 0;
+
+    if (fd < 0)
+        return -1;
+
+    for (R_xlen_t i = 0; i < Rf_xlength(root) && !error; ++i) {
+        const char *id = CHAR(STRING_ELT(root, i));
+        Frame request;
+        int32_t status = -1;
+
+        request.Write((int32_t)op);
+        request.Write((int32_t)INTEGER(inBegin)[i]);
+        request.Write((int32_t)INTEGER(inEnd)[i]);
+        request.Write((int32_t)INTEGER(outBegin)[i]);
+        request.Write((int32_t)INTEGER(outEnd)[i]);
+        request.Write((int32_t)maxDistance);
+        request.buffer.insert(request.buffer.end(), id, id + strlen(id));
+
+        frames.push_back(std::vector<char>());
+        if (request.Send(fd) ||
+            receiveFrame(fd, frames.back(), SERVER_MAX_RESPONSE) ||
+            frames.back().size() < sizeof(status)) {
+            error = -1;
+        } else {
+            memcpy(&status, &frames.back()[0], sizeof(status));
+            error = status;
+        }
+    }
+
+    close(fd);
+
+    return error;
+}
+
+/* Query a server for each root, see ContactsClient in R.
+ *
+ * @return for NETWORK_SUMMARY a list with the integer vectors
+ * inDegree, outDegree, ingoingContactChain and outgoingContactChain.
+ * For SHORTEST_PATHS a list with inIndex, inDistance, inNode,
+ * outIndex, outDistance and outNode, where index is the one-based
+ * query. For TRACE a list with the rowids and distances of the
+ * ingoing and outgoing contacts of each query, as from
+ * traceContacts.
+ */
+extern "C" SEXP contactsClientQuery(
+    SEXP path,
+    SEXP op,
+    SEXP root,
+    SEXP inBegin,
+    SEXP inEnd,
+    SEXP outBegin,
+    SEXP outEnd,
+    SEXP maxDistance)
+{
+    std::vector<std::vector<char> > frames;
+    R_xlen_t len;
+    SEXP result, vec;
+    int error;
+
+    if (!Rf_isString(path) || Rf_xlength(path) != 1 ||
+        STRING_ELT(path, 0) == NA_STRING ||
+        !Rf_isInteger(op) || Rf_xlength(op) != 1 ||
+        !Rf_isString(root) ||
+        !Rf_isInteger(inBegin) || !Rf_isInteger(inEnd) ||
+        !Rf_isInteger(outBegin) || !Rf_isInteger(outEnd) ||
+        Rf_xlength(inBegin) != Rf_xlength(root) ||
+        Rf_xlength(inEnd) != Rf_xlength(root) ||
+        Rf_xlength(outBegin) != Rf_xlength(root) ||
+        Rf_xlength(outEnd) != Rf_xlength(root) ||
+        !Rf_isInteger(maxDistance) || Rf_xlength(maxDistance) != 1)
+        Rf_error("Unable to query the server");
+
+    len = Rf_xlength(root);
+    error = queryServer(
+        R_ExpandFileName(Rf_translateChar(STRING_ELT(path, 0))),
+        INTEGER(op)[0], root, inBegin, inEnd, outBegin, outEnd,
+        INTEGER(maxDistance)[0], frames);
+    if (error) {
+        std::vector<std::vector<char> >().swap(frames);
+        Rf_error("Unable to query the server");
+    }
+
+    switch (INTEGER(op)[0]) {
+    case SERVER_NETWORK_SUMMARY: {
+        const char *names[] = {"inDegree", "outDegree",
+                               "ingoingContactChain",
+                               "outgoingContactChain", ""};
+
+        PROTECT(result = Rf_mkNamed(VECSXP, names));
+        for (int j = 0; j < 4; ++j)
+            SET_VECTOR_ELT(result, j, Rf_allocVector(INTSXP, len));
+        for (R_xlen_t i = 0; i < len; ++i) {
+            ResponseReader reader(frames[i]);
+            reader.Read<int32_t>();
+            for (int j = 0; j < 4; ++j)
+                INTEGER(VECTOR_ELT(result, j))[i] = reader.Read<int32_t>();
+            if (!reader.Ok())
+                error = -1;
+        }
+        break;
+    }
+    case SERVER_TRACE: {
+        std::vector<int64_t> rowid;
+
+        PROTECT(result = Rf_allocVector(VECSXP, 4 * len));
+        for (R_xlen_t i = 0; i < len && !error; ++i) {
+            ResponseReader reader(frames[i]);
+            reader.Read<int32_t>();
+            for (int j = 0; j < 2 && !error; ++j) {
+                int32_t n = reader.Read<int32_t>();
+                bool isLong = false;
+
+                if (n < 0 || !reader.Ok()) {
+                    error = -1;
+                    break;
+                }
+
+                /* Keep 32-bit rowids unless a row doesn't fit. */
+                rowid.resize(n);
+                for (int32_t k = 0; k < n; ++k) {
+                    rowid[k] = reader.Read<int64_t>();
+                    if (rowid[k] > INT_MAX)
+                        isLong = true;
+                }
+                if (isLong) {
+                    SET_VECTOR_ELT(result, 4 * i + 2 * j,
+                                   vec = Rf_allocVector(REALSXP, n));
+                    for (int32_t k = 0; k < n; ++k)
+                        REAL(vec)[k] = rowid[k];
+                } else {
+                    SET_VECTOR_ELT(result, 4 * i + 2 * j,
+                                   vec = Rf_allocVector(INTSXP, n));
+                    for (int32_t k = 0; k < n; ++k)
+                        INTEGER(vec)[k] = rowid[k];
+                }
+                SET_VECTOR_ELT(result, 4 * i + 2 * j + 1,
+                               vec = Rf_allocVector(INTSXP, n));
+                for (int32_t k = 0; k < n; ++k)
+                    INTEGER(vec)[k] = reader.Read<int32_t>();
+                if (!reader.Ok())
+                    error = -1;
+            }
+        }
+        break;
+    }
+    case SERVER_SHORTEST_PATHS: {
+        const char *names[] = {"inIndex", "inDistance", "inNode",
+                               "outIndex", "outDistance", "outNode", ""};
+        R_xlen_t n[2] = {0, 0};
+
+        /* First count the rows of each direction, and check the
+         * responses. */
+        for (R_xlen_t i = 0; i < len && !error; ++i) {
+            ResponseReader reader(frames[i]);
+            reader.Read<int32_t>();
+            for (int j = 0; j < 2 && !error; ++j) {
+                int32_t m = reader.Read<int32_t>();
+                if (m < 0 || !reader.Ok()) {
+                    error = -1;
+                    break;
+                }
+                n[j] += m;
+                for (int32_t k = 0; k < m && reader.Ok(); ++k)
+                    reader.Read<int32_t>();
+                for (int32_t k = 0; k < m && reader.Ok(); ++k)
+                    reader.SkipString();
+                if (!reader.Ok())
+                    error = -1;
+            }
+        }
+        if (error)
+            break;
+
+        PROTECT(result = Rf_mkNamed(VECSXP, names));
+        for (int j = 0; j < 2; ++j) {
+            SET_VECTOR_ELT(result, 3 * j, Rf_allocVector(INTSXP, n[j]));
+            SET_VECTOR_ELT(result, 3 * j + 1, Rf_allocVector(INTSXP, n[j]));
+            SET_VECTOR_ELT(result, 3 * j + 2, Rf_allocVector(STRSXP, n[j]));
+        }
+
+        R_xlen_t pos[2] = {0, 0};
+        for (R_xlen_t i = 0; i < len && !error; ++i) {
+            ResponseReader reader(frames[i]);
+            reader.Read<int32_t>();
+            for (int j = 0; j < 2 && !error; ++j) {
+                int32_t m = reader.Read<int32_t>();
+                if (m < 0 || !reader.Ok()) {
+                    error = -1;
+                    break;
+                }
+                for (int32_t k = 0; k < m && reader.Ok(); ++k) {
+                    INTEGER(VECTOR_ELT(result, 3 * j))[pos[j] + k] = i + 1;
+                    INTEGER(VECTOR_ELT(result, 3 * j + 1))[pos[j] + k] =
+                        reader.Read<int32_t>();
+                }
+                for (int32_t k = 0; k < m && reader.Ok(); ++k) {
+                    SET_STRING_ELT(VECTOR_ELT(result, 3 * j + 2),
+                                   pos[j] + k, reader.ReadString());
+                }
+                if (!reader.Ok())
+                    error = -1;
+                pos[j] += m;
+            }
+        }
+        break;
+    }
+    default:
+        Rf_error("Unable to query the server");
+    }
+
+    if (error) {
+        std::vector<std::vector<char> >().swap(frames);
+        Rf_error("Unable to query the server");
+    }
+
+    UNPROTECT(1);
+
+    return result;
+}
+
+#else
+
+extern "C" SEXP contactsServerStart(SEXP image, SEXP nodes, SEXP path,
+                                    SEXP threads)
+{
+    Rf_error("The server is not supported on this platform");
+    return R_NilValue;
+}
+
+extern "C" SEXP contactsServerStop(SEXP ptr)
+{
+    Rf_error("The server is not supported on this platform");
+    return R_NilValue;
+}
+
+extern "C" SEXP contactsClientQuery(SEXP path, SEXP op, SEXP root,
+                                    SEXP inBegin, SEXP inEnd,
+                                    SEXP outBegin, SEXP outEnd,
+                                    SEXP maxDistance)
+{
+    Rf_error("The server is not supported on this platform");
+    return R_NilValue;
+}
+
+#endif
@@ -0,0 +1,419 @@
+/*
+ * Copyright 2013-2020 Stefan Widgren and Maria Noremark,
+ * National Veterinary Institute, Sweden
+ *
+ * Licensed under the EUPL, Version 1.1 or - as soon they
+ * will be approved by the European Commission - subsequent
+ * versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the
+ * Licence.
+ * You may obtain a copy of the Licence at:
+ *
+ * http: *ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in
+ * writing, software distributed under the Licence is
+ * distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the Licence for the specific language governing
+ * permissions and limitations under the Licence.
+ */
+
+
+/*
+ * Monte Carlo simulation of the spread of an infection along the
+ * movements, see SpreadSimulation in R.
+ *
+ * A replicate starts with the roots infected on the first day of the
+ * time window. A movement from an infected holding on the day of the
+ * infection or later transmits the infection to the destination
+ * with the probability of its row, and the destination is infected
+ * on the day of the movement. The holdings are processed in the
+ * order of their day of infection, so each movement is drawn at most
+ * once, when its source is infected before or on the day of the
+ * movement, exactly as if the movements were replayed in time order.
+ * A movement to a holding that is already infected on the same day
+ * or earlier does not change the outcome and is not drawn.
+ *
+ * Each replicate has its own stream of random numbers from the seed
+ * and the number of the replicate, such that the result does not
+ * depend on the number of threads. The replicates are run in
+ * parallel with OpenMP, each thread with its own work memory and
+ * counts. The day of infection of each holding is counted for each
+ * day that the holding has an ingoing movement, which are the only
+ * days a holding can be infected.
+ */
+
+#include "contacts.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <climits>
+#include <functional>
+#include <queue>
+#include <vector>
+
+#include <R_ext/Random.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* The random number generator xoshiro256** of Blackman and Vigna,
+ * seeded with splitmix64. */
+class SimulationRandom {
+public:
+    SimulationRandom(uint64_t seed, uint64_t stream) {
+        uint64_t x = seed ^ (stream * 0x9e3779b97f4a7c15ULL);
+
+        for (int i = 0; i < 4; ++i)
+            s[i] = SplitMix(x);
+    }
+
+    /* A uniform number in [0, 1). */
+    double Uniform(void) {
+        return (Next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+private:
+    uint64_t s[4];
+
+    static uint64_t Rotl(uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    static uint64_t SplitMix(uint64_t& x) {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t Next(void) {
+        uint64_t result = Rotl(s[1] * 5, 7) * 9;
+        uint64_t t = s[1] << 17;
+
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = Rotl(s[3], 45);
+
+        return result;
+    }
+};
+
+/* The days that each node can be infected on, the days of the
+ * ingoing contacts in the time window and the first day for the
+ * roots, in compressed sparse rows. The nodes are internal
+ * identifiers. */
+class SimulationDays {
+public:
+    SimulationDays(const ContactsIndex& index,
+                   const std::vector<int>& roots,
+                   int tBegin,
+                   int tEnd)
+        : offset(index.N() + 1, 0)
+        {
+            const ContactsLookup& data = index.ingoing;
+            std::vector<char> root(index.N(), 0);
+
+            for (size_t i = 0; i < roots.size(); ++i)
+                root[roots[i]] = 1;
+
+            for (int node = 0; node < index.N(); ++node) {
+                size_t first = day.size();
+
+                if (root[node])
+                    day.push_back(tBegin);
+
+                ContactsEdges edges(data, node, tBegin, tEnd);
+                for (int i = 0; i < edges.Size(); ++i) {
+                    int e = edges[i];
+                    const int *t_begin =
+                        contactsLowerBound(data.Begin(e), data.End(e), tBegin);
+                    const int *t_end =
+                        contactsUpperBound(t_begin, data.End(e), tEnd);
+
+                    day.insert(day.end(), t_begin, t_end);
+                }
+
+                std::sort(day.begin() + first, day.end());
+                day.erase(std::unique(day.begin() + first, day.end()),
+                          day.end());
+                offset[node + 1] = day.size();
+            }
+        }
+
+    /* The position of the day of the node in day. */
+    size_t Position(int node, int t) const {
+        return std::lower_bound(day.begin() + offset[node],
+                                day.begin() + offset[node + 1], t) -
+            day.begin();
+    }
+
+    std::vector<size_t> offset;
+    std::vector<int> day;
+};
+
+/* The work memory and the counts of one thread. */
+class SpreadSimulator {
+public:
+    SpreadSimulator(const ContactsIndex& index,
+                    const SimulationDays& days,
+                    const double *probability,
+                    bool constant,
+                    int tBegin,
+                    int tEnd)
+        : count(days.day.size(), 0),
+          index(index),
+          days(days),
+          probability(probability),
+          constant(constant),
+          tBegin(tBegin),
+          tEnd(tEnd),
+          infected(index.N(), INT_MAX)
+        {}
+
+    /* Run a replicate and return the number of infected holdings. */
+    int Run(const std::vector<int>& roots, SimulationRandom& random) {
+        const ContactsLookup& data = index.outgoing;
+
+        for (size_t i = 0; i < roots.size(); ++i) {
+            if (infected[roots[i]] == INT_MAX) {
+                infected[roots[i]] = tBegin;
+                queue.push(std::make_pair(tBegin, roots[i]));
+            }
+        }
+
+        while (!queue.empty()) {
+            int tau = queue.top().first;
+            int node = queue.top().second;
+            queue.pop();
+
+            /* The node was infected earlier by another movement. */
+            if (tau != infected[node])
+                continue;
+            reached.push_back(node);
+
+            edges.Reset(data, node, tau, tEnd);
+            for (int i = 0; i < edges.Size(); ++i) {
+                int e = edges[i];
+                int neighbour = data.neighbour[e];
+                const int *t_begin =
+                    contactsLowerBound(data.Begin(e), data.End(e), tau);
+                const int *t_end =
+                    contactsUpperBound(t_begin, data.End(e), tEnd);
+
+                for (const int *iit = t_begin; iit != t_end; ++iit) {
+                    /* The contacts are sorted on the day, so the
+                     * later contacts can't change the outcome
+                     * either. */
+                    if (infected[neighbour] <= *iit)
+                        break;
+
+                    double p = probability[constant ? 0 : data.Rowid(iit)];
+                    if (p >= 1 || (p > 0 && random.Uniform() < p)) {
+                        infected[neighbour] = *iit;
+                        queue.push(std::make_pair(*iit, neighbour));
+                    }
+                }
+            }
+        }
+
+        int size = reached.size();
+        for (size_t i = 0; i < reached.size(); ++i) {
+            int node = reached[i];
+
+            count[days.Position(node, infected[node])]++;
+            infected[node] = INT_MAX;
+        }
+        reached.clear();
+
+        return size;
+    }
+
+    /* The number of replicates that infected each node on each day,
+     * see SimulationDays. */
+    std::vector<int> count;
+
+private:
+    const ContactsIndex& index;
+    const SimulationDays& days;
+    const double *probability;
+    bool constant;
+    int tBegin;
+    int tEnd;
+
+    /* The day of infection of each node, or INT_MAX. */
+    std::vector<int> infected;
+
+    /* The infected nodes in the order of the day of infection. */
+    std::vector<int> reached;
+
+    std::priority_queue<std::pair<int, int>,
+                        std::vector<std::pair<int, int> >,
+                        std::greater<std::pair<int, int> > > queue;
+    ContactsEdges edges;
+
+    SpreadSimulator(const SpreadSimulator&);
+    SpreadSimulator& operator=(const SpreadSimulator&);
+};
+
+/* Simulate the spread of an infection from the roots, see
+ * SpreadSimulation in R.
+ *
+ * @param src the one-based source of each movement.
+ * @param dst the one-based destination of each movement.
+ * @param t the day of each movement.
+ * @param root the one-based roots that are infected on tBegin.
+ * @param tBegin the first day of the simulation.
+ * @param tEnd the last day of the simulation.
+ * @param probability the probability of transmission of each
+ * movement, or one probability for all.
+ * @param numberOfIdentifiers the number of holdings.
+ * @param replicates the number of replicates.
+ * @param order the order of the holdings in the index.
+ * @param threads the number of threads, or 0 for the OpenMP default.
+ * @return a list with the number of infected holdings in each
+ * replicate in size, and the one-based node, day t and number of
+ * replicates in count of each day that a holding was infected on.
+ */
+extern "C" SEXP contactsSimulation(
+    SEXP src,
+    SEXP dst,
+    SEXP t,
+    SEXP root,
+    SEXP tBegin,
+    SEXP tEnd,
+    SEXP probability,
+    SEXP numberOfIdentifiers,
+    SEXP replicates,
+    SEXP order,
+    SEXP threads)
+{
+    const char *names[] = {"size", "node", "t", "count", ""};
+    ContactsIndex index;
+    ContactsWindows windows;
+    std::vector<int> roots;
+    std::vector<SpreadSimulator*> work;
+    uint64_t seed;
+    int n, len, k;
+    SEXP result, vec, node, day, count;
+
+    if (!Rf_isInteger(root) ||
+        !Rf_isInteger(tBegin) || Rf_xlength(tBegin) != 1 ||
+        INTEGER(tBegin)[0] == NA_INTEGER ||
+        !Rf_isInteger(tEnd) || Rf_xlength(tEnd) != 1 ||
+        INTEGER(tEnd)[0] == NA_INTEGER ||
+        INTEGER(tEnd)[0] < INTEGER(tBegin)[0] ||
+        !Rf_isReal(probability) ||
+        (Rf_xlength(probability) != 1 &&
+         Rf_xlength(probability) != Rf_xlength(t)) ||
+        !Rf_isInteger(numberOfIdentifiers) ||
+        Rf_xlength(numberOfIdentifiers) != 1 ||
+        !Rf_isInteger(replicates) || Rf_xlength(replicates) != 1 ||
+        INTEGER(replicates)[0] == NA_INTEGER || INTEGER(replicates)[0] < 0 ||
+        !Rf_isInteger(order) || Rf_xlength(order) != 1 ||
+        !Rf_isInteger(threads) || Rf_xlength(threads) != 1 ||
+        INTEGER(threads)[0] == NA_INTEGER || INTEGER(threads)[0] < 0)
+        Rf_error("Unable to simulate the spread");
+
+    for (R_xlen_t i = 0; i < Rf_xlength(probability); ++i) {
+        double p = REAL(probability)[i];
+        if (ISNAN(p) || p < 0 || p > 1)
+            Rf_error("Unable to simulate the spread");
+    }
+
+    /* Only the movements in the time window can spread the
+     * infection. */
+    windows.push_back(std::make_pair(INTEGER(tBegin)[0], INTEGER(tEnd)[0]));
+    if (buildContactsIndex(index, src, dst, t,
+                           INTEGER(numberOfIdentifiers)[0],
+                           INTEGER(order)[0],
+                           &windows,
+                           &windows))
+        Rf_error("Unable to simulate the spread");
+
+    for (int i = 0; i < Rf_length(root); ++i) {
+        if (INTEGER(root)[i] == NA_INTEGER || INTEGER(root)[i] < 1 ||
+            INTEGER(root)[i] > index.N())
+            Rf_error("Unable to simulate the spread");
+        roots.push_back(index.Internal(INTEGER(root)[i] - 1));
+    }
+
+    /* The seed is drawn with the random number generator of R, so
+     * that set.seed reproduces the simulation. */
+    GetRNGstate();
+    seed = (uint64_t)(unif_rand() * 4294967296.0) << 32;
+    seed |= (uint64_t)(unif_rand() * 4294967296.0);
+    PutRNGstate();
+
+    len = INTEGER(replicates)[0];
+    n = contactsThreads(INTEGER(threads)[0]);
+
+    SimulationDays days(index, roots, INTEGER(tBegin)[0], INTEGER(tEnd)[0]);
+    for (int i = 0; i < n; ++i) {
+        work.push_back(new SpreadSimulator(index, days, REAL(probability),
+                                           Rf_xlength(probability) == 1,
+                                           INTEGER(tBegin)[0],
+                                           INTEGER(tEnd)[0]));
+    }
+
+    PROTECT(result = Rf_mkNamed(VECSXP, names));
+    SET_VECTOR_ELT(result, 0, vec = Rf_allocVector(INTSXP, len));
+    int *size = INTEGER(vec);
+
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(n) schedule(dynamic, 1)
+#endif
+    for (int i = 0; i < len; ++i) {
+#ifdef _OPENMP
+        SpreadSimulator *w = work[omp_get_thread_num()];
+#else
+        SpreadSimulator *w = work[0];
+#endif
+        SimulationRandom random(seed, i);
+        size[i] = w->Run(roots, random);
+    }
+
+    /* Sum the counts of the threads into the first. */
+    std::vector<int>& sum = work[0]->count;
+    for (int j = 1; j < n; ++j) {
+        for (size_t i = 0; i < sum.size(); ++i)
+            sum[i] += work[j]->count[i];
+    }
+
+    k = 0;
+    for (size_t i = 0; i < sum.size(); ++i) {
+        if (sum[i])
+            k++;
+    }
+
+    SET_VECTOR_ELT(result, 1, node = Rf_allocVector(INTSXP, k));
+    SET_VECTOR_ELT(result, 2, day = Rf_allocVector(INTSXP, k));
+    SET_VECTOR_ELT(result, 3, count = Rf_allocVector(INTSXP, k));
+    k = 0;
+    for (int i = 0; i < index.N(); ++i) {
+        int v = index.Internal(i);
+
+        for (size_t j = days.offset[v]; j < days.offset[v + 1]; ++j) {
+            if (sum[j]) {
+                INTEGER(node)[k] = i + 1;
+                INTEGER(day)[k] = days.day[j];
+                INTEGER(count)[k] = sum[j];
+                k++;
+            }
+        }
+    }
+
+    for (int j = 0; j < n; ++j)
+        delete work[j];
+
+    UNPROTECT(1);
+
+    return result;
+}
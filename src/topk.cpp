@@ -0,0 +1,398 @@
+/*
+ * Copyright 2013-2020 Stefan Widgren and Maria Noremark,
+ * National Veterinary Institute, Sweden
+ *
+ * Licensed under the EUPL, Version 1.1 or - as soon they
+ * will be approved by the European Commission - subsequent
+ * versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the
+ * Licence.
+ * You may obtain a copy of the Licence at:
+ *
+ * http: *ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in
+ * writing, software distributed under the Licence is
+ * distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the Licence for the specific language governing
+ * permissions and limitations under the Licence.
+ */
+
+
+/*
+ * The holdings with the largest ingoing or outgoing contact chains
+ * in a time window, see TopContactChains in R, without tracing the
+ * contact chain of every holding.
+ *
+ * An upper bound of the contact chain of every holding is found
+ * from the static graph of the holdings with contacts in the time
+ * window. The contact chain of a holding is a subset of the holdings
+ * that can be reached in the static graph, which are the holdings in
+ * its strongly connected component and the holdings that can be
+ * reached from the components that it has contacts with. The bound
+ * of a component is its size plus the bounds of those components,
+ * found in one pass with the components in the order of Tarjan's
+ * algorithm, where a component is completed after the components it
+ * has contacts with. The in- or out-degree is a lower bound, and the
+ * k-th largest degree is a lower bound of the k-th largest contact
+ * chain.
+ *
+ * The holdings are traced in batches in the order of their bounds,
+ * in parallel with one ContactsTracer per thread, and the tracing
+ * stops when the bound of the next holding is below the k-th
+ * largest contact chain so far, or the k-th largest degree, since
+ * then no other holding can enter the top k.
+ *
+ * In wide windows on dense networks, the contacts are first bounded
+ * on the coarse level of the lookup, with the contacts aggregated by
+ * week, see ContactsCoarse. A holding is skipped if its coarse upper
+ * bound is below the threshold, and its contact chain is known
+ * without tracing the contacts if the coarse lower and upper bounds
+ * are equal. The coarse traversals expand each holding once, while
+ * the depth-first traversal of the contacts can expand a holding
+ * again each time it is reached earlier.
+ */
+
+#include "trace.h"
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* The upper bound of the contact chain of each internal node, from
+ * the strongly connected components of the static graph of the
+ * edges with contacts in [tBegin, tEnd], see above, and the degree
+ * of each internal node, the number of such edges to other nodes. */
+void
+topBounds(const ContactsLookup& data,
+          int n,
+          int tBegin,
+          int tEnd,
+          std::vector<int>& bound,
+          std::vector<int>& degree)
+{
+    /* The state of Tarjan's algorithm, with an explicit stack of the
+     * nodes to continue and the next edge of each. Every edge is
+     * visited once, so the hub directory is not used, and the edges
+     * with contacts in the window are marked in active. */
+    std::vector<int> number(n, -1), low(n, 0), component(n, -1);
+    std::vector<int> position(n, 0), stack, path, next;
+    std::vector<int> size, stamp;
+    std::vector<char> active(data.neighbour.size(), 0);
+    int count = 0;
+
+    bound.assign(n, 0);
+    degree.assign(n, 0);
+    for (int root = 0; root < n; ++root) {
+        if (number[root] >= 0)
+            continue;
+
+        number[root] = low[root] = count++;
+        position[root] = stack.size();
+        stack.push_back(root);
+        path.push_back(root);
+        next.push_back(data.Active(root, tBegin, tEnd) ?
+                       data.nodeOffset[root] : data.nodeOffset[root + 1]);
+
+        while (!path.empty()) {
+            int node = path.back();
+
+            if (next.back() < data.nodeOffset[node + 1]) {
+                int e = next.back()++;
+                int neighbour = data.neighbour[e];
+                const int *t_begin =
+                    contactsLowerBound(data.Begin(e), data.End(e), tBegin);
+
+                /* We are not interested in going in loops. */
+                if (neighbour == node || t_begin == data.End(e) ||
+                    *t_begin > tEnd)
+                    continue;
+                active[e] = 1;
+                degree[node]++;
+
+                if (number[neighbour] < 0) {
+                    number[neighbour] = low[neighbour] = count++;
+                    position[neighbour] = stack.size();
+                    stack.push_back(neighbour);
+                    path.push_back(neighbour);
+                    next.push_back(data.Active(neighbour, tBegin, tEnd) ?
+                                   data.nodeOffset[neighbour] :
+                                   data.nodeOffset[neighbour + 1]);
+                } else if (component[neighbour] < 0) {
+                    low[node] = std::min(low[node], number[neighbour]);
+                }
+
+                continue;
+            }
+
+            path.pop_back();
+            next.pop_back();
+            if (!path.empty())
+                low[path.back()] = std::min(low[path.back()], low[node]);
+            if (low[node] != number[node])
+                continue;
+
+            /* Complete the component of node. The components that it
+             * has contacts with are already completed. */
+            int c = size.size();
+            size_t first = position[node];
+            long long sum = stack.size() - first;
+
+            stamp.push_back(-1);
+            for (size_t i = first; i < stack.size(); ++i)
+                component[stack[i]] = c;
+            size.push_back(stack.size() - first);
+
+            for (size_t i = first; i < stack.size() && sum < n; ++i) {
+                int v = stack[i];
+                int end = data.nodeOffset[v + 1];
+
+                for (int e = data.nodeOffset[v]; e < end; ++e) {
+                    int d = component[data.neighbour[e]];
+
+                    if (!active[e] || d == c || stamp[d] == c)
+                        continue;
+                    stamp[d] = c;
+                    sum += size[d];
+                }
+            }
+
+            /* size is the bound of the component from here on. */
+            size[c] = sum < n ? sum : n;
+            for (size_t i = first; i < stack.size(); ++i)
+                bound[stack[i]] = size[c] - 1;
+            stack.resize(first);
+        }
+    }
+}
+
+/* The coarse level is only used for windows of at least this
+ * number of periods, and if the edges have contacts in at least
+ * this number of periods on average. The bounds of a narrow window
+ * are loose, and the depth-first traversal of the contacts is
+ * already fast if the edges have few contacts. */
+#define TOP_COARSE_PERIODS 16
+#define TOP_COARSE_DENSITY 2
+
+/* Build the coarse level of the lookup if its bounds are likely to
+ * save more time than they take in [tBegin, tEnd]. */
+static bool
+topCoarse(ContactsLookup& data, int tBegin, int tEnd)
+{
+    if ((double)tEnd - (double)tBegin + 1.0 <
+        (double)TOP_COARSE_PERIODS * CONTACTS_COARSE_WIDTH)
+        return false;
+
+    buildContactsCoarse(data, CONTACTS_COARSE_WIDTH);
+    if (data.coarse.period.size() <
+        TOP_COARSE_DENSITY * data.neighbour.size()) {
+        data.coarse = ContactsCoarse();
+        return false;
+    }
+
+    return true;
+}
+
+/* Order the candidates on decreasing bound, and then on the
+ * identifier. */
+struct TopCandidate {
+    int bound;
+    int node;
+
+    bool operator<(const TopCandidate& other) const {
+        if (bound != other.bound)
+            return bound > other.bound;
+        return node < other.node;
+    }
+};
+
+/* Order the result on the decreasing contact chain, and then on the
+ * identifier. */
+struct TopResult {
+    int size;
+    int node;
+    bool traced;
+
+    bool operator<(const TopResult& other) const {
+        if (size != other.size)
+            return size > other.size;
+        return node < other.node;
+    }
+};
+
+/* The holdings with the largest contact chains.
+ *
+ * @param image the image of the index.
+ * @param ingoing TRUE for the ingoing contact chains, FALSE for the
+ * outgoing contact chains.
+ * @param tBegin the start of the time window.
+ * @param tEnd the end of the time window.
+ * @param k the number of holdings.
+ * @param threads the number of threads, or 0 for the OpenMP default.
+ * @return a list with the one-based node and the contactChain of the
+ * k holdings with the largest contact chains in decreasing order,
+ * and traced, the number of contact chains that were traced.
+ */
+extern "C" SEXP topContactChains(
+    SEXP image,
+    SEXP ingoing,
+    SEXP tBegin,
+    SEXP tEnd,
+    SEXP k,
+    SEXP threads)
+{
+    const char *names[] = {"node", "contactChain", "traced", ""};
+    ContactsIndex index;
+    std::vector<ContactsTracer*> tracers;
+    std::vector<TopCandidate> candidates;
+    std::vector<TopResult> results;
+    std::vector<int> bound, degree;
+    std::priority_queue<int, std::vector<int>, std::greater<int> > top;
+    int n, len, lower = 0, traced = 0;
+    bool in, coarse;
+    SEXP result, vec;
+
+    if (!Rf_isLogical(ingoing) || Rf_xlength(ingoing) != 1 ||
+        LOGICAL(ingoing)[0] == NA_LOGICAL ||
+        !Rf_isInteger(tBegin) || Rf_xlength(tBegin) != 1 ||
+        INTEGER(tBegin)[0] == NA_INTEGER ||
+        !Rf_isInteger(tEnd) || Rf_xlength(tEnd) != 1 ||
+        INTEGER(tEnd)[0] == NA_INTEGER ||
+        !Rf_isInteger(k) || Rf_xlength(k) != 1 ||
+        INTEGER(k)[0] == NA_INTEGER || INTEGER(k)[0] < 0 ||
+        !Rf_isInteger(threads) || Rf_xlength(threads) != 1 ||
+        INTEGER(threads)[0] == NA_INTEGER || INTEGER(threads)[0] < 0 ||
+        readContactsIndex(index, image))
+        Rf_error("Unable to find the top contact chains");
+
+    in = LOGICAL(ingoing)[0];
+    len = std::min(INTEGER(k)[0], index.N());
+    coarse = topCoarse(in ? index.ingoing : index.outgoing,
+                       INTEGER(tBegin)[0], INTEGER(tEnd)[0]);
+
+    n = contactsTracers(index, INTEGER(threads)[0], tracers);
+
+    topBounds(in ? index.ingoing : index.outgoing, index.N(),
+              INTEGER(tBegin)[0], INTEGER(tEnd)[0], bound, degree);
+    for (int i = 0; i < index.N(); ++i) {
+        TopCandidate candidate = {bound[index.Internal(i)], i};
+        candidates.push_back(candidate);
+    }
+
+    if (len > 0) {
+        std::nth_element(degree.begin(), degree.begin() + len - 1,
+                         degree.end(), std::greater<int>());
+        lower = degree[len - 1];
+    }
+
+    std::sort(candidates.begin(), candidates.end());
+
+    for (size_t first = 0; first < candidates.size() && len > 0;) {
+        int threshold = lower;
+        if ((int)top.size() == len && top.top() > threshold)
+            threshold = top.top();
+
+        /* No other holding can enter the top k. */
+        if (candidates[first].bound < threshold)
+            break;
+
+        /* The holdings without contacts are not traced. */
+        if (candidates[first].bound == 0) {
+            TopResult r = {0, candidates[first].node, false};
+            results.push_back(r);
+            first++;
+            continue;
+        }
+
+        size_t last = first;
+        while (last < candidates.size() && last - first < (size_t)(8 * n) &&
+               candidates[last].bound >= threshold &&
+               candidates[last].bound > 0)
+            last++;
+
+        TopResult empty = {0, 0, false};
+        results.resize(results.size() + (last - first), empty);
+        TopResult *batch = &results[results.size() - (last - first)];
+
+#ifdef _OPENMP
+        #pragma omp parallel for num_threads(n) schedule(dynamic, 1)
+#endif
+        for (int i = 0; i < (int)(last - first); ++i) {
+#ifdef _OPENMP
+            ContactsTracer *tracer = tracers[omp_get_thread_num()];
+#else
+            ContactsTracer *tracer = tracers[0];
+#endif
+            int node = candidates[first + i].node;
+            int upper = candidates[first + i].bound;
+
+            /* Only trace the contacts if the bounds from the coarse
+             * level are inconclusive. */
+            batch[i].node = node;
+            if (coarse) {
+                upper = std::min(upper, tracer->ContactChainBound(
+                                     node, INTEGER(tBegin)[0],
+                                     INTEGER(tEnd)[0], in, true));
+                if (upper < threshold) {
+                    batch[i].size = -1;
+                    continue;
+                }
+
+                if (tracer->ContactChainBound(node, INTEGER(tBegin)[0],
+                                              INTEGER(tEnd)[0], in,
+                                              false) == upper) {
+                    batch[i].size = upper;
+                    continue;
+                }
+            }
+
+            batch[i].size = tracer->ContactChain(node, INTEGER(tBegin)[0],
+                                                 INTEGER(tEnd)[0], in);
+            batch[i].traced = true;
+        }
+
+        for (size_t i = 0; i < last - first; ++i) {
+            if (batch[i].traced)
+                traced++;
+            if (batch[i].size < 0)
+                continue;
+            top.push(batch[i].size);
+            if ((int)top.size() > len)
+                top.pop();
+        }
+
+        first = last;
+    }
+
+    /* The holdings that were not traced, or with an upper bound
+     * below the threshold, can't be in the top k, also not with a
+     * tie. */
+    std::sort(results.begin(), results.end());
+    while (!results.empty() && results.back().size < 0)
+        results.pop_back();
+    if ((int)results.size() > len)
+        results.resize(len);
+
+    PROTECT(result = Rf_mkNamed(VECSXP, names));
+    SET_VECTOR_ELT(result, 0, vec = Rf_allocVector(INTSXP, results.size()));
+    for (size_t i = 0; i < results.size(); ++i)
+        INTEGER(vec)[i] = results[i].node + 1;
+    SET_VECTOR_ELT(result, 1, vec = Rf_allocVector(INTSXP, results.size()));
+    for (size_t i = 0; i < results.size(); ++i)
+        INTEGER(vec)[i] = results[i].size;
+    SET_VECTOR_ELT(result, 2, Rf_ScalarInteger(traced));
+
+    for (int i = 0; i < n; ++i)
+        delete tracers[i];
+
+    UNPROTECT(1);
+
+    return result;
+}
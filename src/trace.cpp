@@ -23,12 +23,15 @@
 #define R_NO_REMAP
 #define STRICT_R_HEADERS
 
+#include "trace.h"
 #include "kvec.h"
 #include <string.h>
 
 #include <algorithm>
+#include <climits>
+#include <functional>
+#include <list>
 #include <map>
-#include <set>
 #include <utility>
 #include <vector>
 
@@ -36,30 +39,18 @@
 #include <R_ext/Rdynload.h>
 #include <R_ext/Visibility.h>
 
-typedef struct Contact
-{
-  int rowid;
-  int identifier;
-  int t;
-} Contact;
-
-class CompareContact {
-public:
-    bool operator()(const Contact& c, int t) {
-        return c.t < t;
-    }
-
-    bool operator()(int t, const Contact& c) {
-        return t < c.t;
-    }
-};
-
-/* Help class to keep track of visited nodes. */
+/* Help class to keep track of visited nodes. The nodes are stamped
+ * with the epoch of the root, so that moving to the next root is
+ * O(1). The visited nodes are only recorded in a list when the
+ * caller needs them, e.g. for the cache of contact chains. */
 class VisitedNodes {
 public:
-    VisitedNodes(size_t numberOfIdentifiers)
+    VisitedNodes(size_t numberOfIdentifiers, bool record = false)
         : numberOfVisitedNodes(0),
-          visitedNodes(numberOfIdentifiers)
+          epoch(1),
+          record(record),
+          stamp(numberOfIdentifiers, 0),
+          bound(numberOfIdentifiers)
         {}
 
     int N(void) const {
@@ -67,31 +58,33 @@ public:
     }
 
     void Update(int node, int tBegin, int tEnd, bool ingoing) {
-        if (visitedNodes[node].first) {
+        if (stamp[node] == epoch) {
             if (ingoing) {
-                if (tEnd > visitedNodes[node].second) {
-                    visitedNodes[node].second = tEnd;
+                if (tEnd > bound[node]) {
+                    bound[node] = tEnd;
                 }
-            } else if (tBegin < visitedNodes[node].second) {
-                visitedNodes[node].second = tBegin;
+            } else if (tBegin < bound[node]) {
+                bound[node] = tBegin;
             }
         } else {
-            visitedNodes[node].first = true;
+            stamp[node] = epoch;
             numberOfVisitedNodes++;
+            if (record)
+                nodes.push_back(node);
             if (ingoing)
-                visitedNodes[node].second = tEnd;
+                bound[node] = tEnd;
             else
-                visitedNodes[node].second = tBegin;
+                bound[node] = tBegin;
         }
     }
 
     bool Visit(int node, int tBegin, int tEnd, bool ingoing) {
-        if (visitedNodes[node].first) {
+        if (stamp[node] == epoch) {
             if (ingoing) {
-                if (tEnd <= visitedNodes[node].second) {
+                if (tEnd <= bound[node]) {
                     return false;
                 }
-            } else if (tBegin >= visitedNodes[node].second) {
+            } else if (tBegin >= bound[node]) {
                 return false;
             }
         }
@@ -99,12 +92,230 @@ public:
         return true;
     }
 
+    /* Record the visited nodes from the next Clear, see Nodes. */
+    void Record(bool value) {
+        record = value;
+    }
+
+    /* The visited nodes in the order they were first visited. Only
+     * valid when the nodes are recorded. */
+    const std::vector<int>& Nodes(void) const {
+        return nodes;
+    }
+
+    /* The time bound that a visited node was reached with. */
+    int Bound(int node) const {
+        return bound[node];
+    }
+
+    /* Forget the visited nodes, to reuse the instance for the next
+     * root. */
+    void Clear(void) {
+        if (epoch == INT_MAX) {
+            std::fill(stamp.begin(), stamp.end(), 0);
+            epoch = 0;
+        }
+        epoch++;
+        nodes.clear();
+        numberOfVisitedNodes = 0;
+    }
+
 private:
     int numberOfVisitedNodes;
-    std::vector<std::pair<bool, int> > visitedNodes;
+    int epoch;
+    bool record;
+    std::vector<int> stamp;
+    std::vector<int> bound;
+    std::vector<int> nodes;
+};
+
+/* Help class to keep track of the nodes in the current search path.
+ * The nodes are added when the search enters a node and removed when
+ * it backtracks, so one instance is reused for all roots without
+ * copying the path in every recursive call. */
+class PathNodes {
+public:
+    PathNodes(size_t numberOfIdentifiers)
+        : path(numberOfIdentifiers, false)
+        {}
+
+    bool Contains(int node) const {
+        return path[node];
+    }
+
+    void Enter(int node) {
+        path[node] = true;
+    }
+
+    void Leave(int node) {
+        path[node] = false;
+    }
+
+private:
+    std::vector<bool> path;
+};
+
+/* Bounded LRU cache with the contact chain of nodes that have been
+ * traced from scratch, to reuse the work when the same node is
+ * reached again from another root. An entry is keyed on the node and
+ * on the fixed bound of the time window, i.e. tEnd for outgoing and
+ * tBegin for ingoing contacts. Since the traversal from a node only
+ * depends on the moving bound through the first contact within the
+ * window, an entry is valid for every moving bound from the traced
+ * one up to the first contact of the node. For ingoing contacts the
+ * moving bound, tEnd, is negated so that both directions are
+ * monotone in the same way. The capacity is the total number of
+ * nodes stored in the contact chains. */
+class ContactChainCache {
+public:
+    /* Visited node and the time bound it was reached with. */
+    typedef std::vector<std::pair<int, int> > Chain;
+
+    ContactChainCache(size_t capacity)
+        : capacity(capacity),
+          size(0)
+        {}
+
+    const Chain* Lookup(int node, int tBegin, int tEnd, bool ingoing) {
+        Key key = {node, ingoing ? tBegin : tEnd, ingoing ? -tEnd : tBegin};
+        std::map<Key, Entry>::iterator it = entries.upper_bound(key);
+
+        if (it == entries.begin())
+            return NULL;
+        --it;
+        if (it->first.node != key.node ||
+            it->first.fixed != key.fixed ||
+            it->second.last < key.moving)
+            return NULL;
+
+        lru.splice(lru.begin(), lru, it->second.lru);
+
+        return &it->second.chain;
+    }
+
+    void Insert(int node, int tBegin, int tEnd, int last, bool ingoing,
+                const Chain& chain) {
+        Key key = {node, ingoing ? tBegin : tEnd, ingoing ? -tEnd : tBegin};
+
+        if (chain.size() > capacity || entries.find(key) != entries.end())
+            return;
+
+        lru.push_front(key);
+        Entry& entry = entries[key];
+        entry.last = last;
+        entry.chain = chain;
+        entry.lru = lru.begin();
+        size += chain.size();
+
+        while (size > capacity) {
+            std::map<Key, Entry>::iterator it = entries.find(lru.back());
+            size -= it->second.chain.size();
+            entries.erase(it);
+            lru.pop_back();
+        }
+    }
+
+private:
+    struct Key {
+        int node;
+        int fixed;
+        int moving;
+
+        bool operator<(const Key& other) const {
+            if (node != other.node)
+                return node < other.node;
+            if (fixed != other.fixed)
+                return fixed < other.fixed;
+            return moving < other.moving;
+        }
+    };
+
+    struct Entry {
+        /* The last moving bound that the entry is valid for. */
+        int last;
+        Chain chain;
+        std::list<Key>::iterator lru;
+    };
+
+    size_t capacity;
+    size_t size;
+    std::map<Key, Entry> entries;
+
+    /* Most recently used key first. */
+    std::list<Key> lru;
+};
+
+/* Help class to sort queries on (root, tBegin, tEnd) with ties
+ * broken on the position of the query. */
+class CompareQuery {
+public:
+    CompareQuery(const int *root, const int *tBegin, const int *tEnd)
+        : root(root), tBegin(tBegin), tEnd(tEnd)
+        {}
+
+    bool operator()(R_xlen_t a, R_xlen_t b) const {
+        if (root[a] != root[b])
+            return root[a] < root[b];
+        if (tBegin[a] != tBegin[b])
+            return tBegin[a] < tBegin[b];
+        if (tEnd[a] != tEnd[b])
+            return tEnd[a] < tEnd[b];
+        return a < b;
+    }
+
+    bool Equal(R_xlen_t a, R_xlen_t b) const {
+        return root[a] == root[b] &&
+            tBegin[a] == tBegin[b] &&
+            tEnd[a] == tEnd[b];
+    }
+
+private:
+    const int *root;
+    const int *tBegin;
+    const int *tEnd;
 };
 
-typedef std::vector<Contact> Contacts;
+/* Canonicalise the queries in one direction. Each query is mapped to
+ * the position of the first query with an identical (root, tBegin,
+ * tEnd), such that every unique subquery is only traced once and the
+ * result can be scattered back to the duplicates. */
+static std::vector<R_xlen_t>
+uniqueQueries(const int *root,
+              const int *tBegin,
+              const int *tEnd,
+              R_xlen_t len)
+{
+    CompareQuery compare(root, tBegin, tEnd);
+    std::vector<R_xlen_t> order(len);
+    std::vector<R_xlen_t> first(len);
+
+    for (R_xlen_t i = 0; i < len; ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), compare);
+
+    for (R_xlen_t i = 0; i < len; ++i) {
+        if (i > 0 && compare.Equal(order[i - 1], order[i]))
+            first[order[i]] = first[order[i - 1]];
+        else
+            first[order[i]] = order[i];
+    }
+
+    return first;
+}
+
+/* The time windows of the queries, to only index the contacts that
+ * can be reached from a root, see buildContactsIndex. */
+static void
+queryWindows(ContactsWindows& windows, SEXP tBegin, SEXP tEnd)
+{
+    R_xlen_t len = Rf_xlength(tBegin);
+
+    windows.resize(len);
+    for (R_xlen_t i = 0; i < len; ++i) {
+        windows[i].first = INTEGER(tBegin)[i];
+        windows[i].second = INTEGER(tEnd)[i];
+    }
+}
 
 static int check_arguments(
     SEXP src,
@@ -115,7 +326,8 @@ static int check_arguments(
     SEXP inEnd,
     SEXP outBegin,
     SEXP outEnd,
-    SEXP numberOfIdentifiers)
+    SEXP numberOfIdentifiers,
+    SEXP order)
 {
     if (Rf_isNull(root) ||
         Rf_isNull(inBegin) ||
@@ -129,116 +341,138 @@ static int check_arguments(
         !Rf_isInteger(outBegin) ||
         !Rf_isInteger(outEnd) ||
         !Rf_isInteger(numberOfIdentifiers) ||
-        Rf_xlength(numberOfIdentifiers) != 1)
+        Rf_xlength(numberOfIdentifiers) != 1 ||
+        Rf_isNull(order) ||
+        !Rf_isInteger(order) ||
+        Rf_xlength(order) != 1)
         return 1;
     return 0;
 }
 
-static int buildContactsLookup(
-    std::vector<std::map<int, Contacts> >& ingoing,
-    std::vector<std::map<int, Contacts> >& outgoing,
-    SEXP src,
-    SEXP dst,
-    SEXP t)
-{
-    int *ptr_src = INTEGER(src);
-    int *ptr_dst = INTEGER(dst);
-    int *ptr_t = INTEGER(t);
-    R_xlen_t len = Rf_xlength(t);
-    int *rowid = (int *)malloc(len * sizeof(int));
-    if (!rowid)
-        return -1;
+/* Help class to keep the shortest distance, and the rowid of the
+ * contact on that path, to each node reached from a root. The
+ * arrays are indexed by node and stamped with the epoch of the root,
+ * so that moving to the next root is O(1), and the reached nodes are
+ * kept in a list for the output. */
+class ShortestPaths {
+public:
+    ShortestPaths(size_t numberOfIdentifiers)
+        : epoch(0),
+          stamp(numberOfIdentifiers, 0),
+          distance(numberOfIdentifiers),
+          rowid(numberOfIdentifiers)
+        {}
 
-    /* The contacts must be sorted by t. */
-    R_orderVector(rowid, len, Rf_lang1(t), FALSE, FALSE);
+    /* Forget the reached nodes, to reuse the instance for the next
+     * root. */
+    void Clear(void) {
+        if (epoch == INT_MAX) {
+            std::fill(stamp.begin(), stamp.end(), 0);
+            epoch = 0;
+        }
+        epoch++;
+        nodes.clear();
+    }
 
-    for (R_xlen_t i = 0; i < len; ++i) {
-        int j = rowid[i];
+    /* Keep the path to node if it is the first or shorter than the
+     * current path. */
+    void Update(int node, int d, R_xlen_t r) {
+        if (stamp[node] != epoch) {
+            stamp[node] = epoch;
+            distance[node] = d;
+            rowid[node] = r;
+            nodes.push_back(node);
+        } else if (d < distance[node]) {
+            distance[node] = d;
+            rowid[node] = r;
+        }
+    }
 
-        /* Decrement with one since C is zero-based. */
-        int zb_src = ptr_src[j] - 1;
-        int zb_dst = ptr_dst[j] - 1;
+    /* The reached nodes in increasing order. */
+    const std::vector<int>& Nodes(void) {
+        std::sort(nodes.begin(), nodes.end());
+        return nodes;
+    }
 
-        ingoing[zb_dst][zb_src].push_back((Contact){j, zb_src, ptr_t[j]});
-        outgoing[zb_src][zb_dst].push_back((Contact){j, zb_dst, ptr_t[j]});
+    int Distance(int node) const {
+        return distance[node];
     }
 
-    free(rowid);
+    R_xlen_t Rowid(int node) const {
+        return rowid[node];
+    }
 
-    return 0;
-}
+private:
+    int epoch;
+    std::vector<int> stamp;
+    std::vector<int> distance;
+    std::vector<R_xlen_t> rowid;
+    std::vector<int> nodes;
+};
 
 static void
-doShortestPaths(const std::vector<std::map<int, Contacts> >& data,
+doShortestPaths(const ContactsIndex& index,
+                const ContactsLookup& data,
                 const int node,
                 const int tBegin,
                 const int tEnd,
-                std::set<int> visitedNodes,
+                PathNodes& path,
                 const int distance,
                 const bool ingoing,
-                std::map<int, std::pair<int, int> >& result)
+                ShortestPaths& result)
 {
-    visitedNodes.insert(node);
+    path.Enter(node);
+
+    ContactsEdges edges(data, node, tBegin, tEnd);
+    for (int i = 0; i < edges.Size(); ++i) {
+        int e = edges[i];
+        int neighbour = data.neighbour[e];
 
-    for (std::map<int, Contacts>::const_iterator it = data[node].begin(),
-            end = data[node].end(); it != end; ++it)
-    {
         /* We are not interested in going in loops or backwards in the
          * search path. */
-        if (visitedNodes.find(it->first) == visitedNodes.end()) {
+        if (!path.Contains(neighbour)) {
             /* We are only interested in contacts within the specified
              * time period, so first check the lower bound, tBegin. */
-            Contacts::const_iterator t_begin =
-                std::lower_bound(it->second.begin(),
-                                 it->second.end(),
-                                 tBegin,
-                                 CompareContact());
+            const int *t_begin =
+                contactsLowerBound(data.Begin(e), data.End(e), tBegin);
 
-            if (t_begin != it->second.end() && t_begin->t <= tEnd) {
+            if (t_begin != data.End(e) && *t_begin <= tEnd) {
                 int t0, t1;
 
-                std::map<int, std::pair<int, int> >::iterator distance_it =
-                    result.find(it->first);
-                if (distance_it == result.end()) {
-                    result[it->first].first = distance;
-
-                    /* Increment with one since R vector is
-                     * one-based. */
-                    result[it->first].second = t_begin->rowid + 1;
-                }  else if (distance < distance_it->second.first) {
-                    distance_it->second.first = distance;
-
-                    /* Increment with one since R vector is
-                     * one-based. */
-                    distance_it->second.second = t_begin->rowid + 1;
-                }
+                /* The result is keyed on the identifier that is
+                 * visible from R, to keep the order of the result
+                 * independent of the order of the index. */
+                /* Increment with one since R vector is one-based. */
+                result.Update(index.External(neighbour),
+                              distance,
+                              data.Rowid(t_begin) + 1);
 
                 if (ingoing) {
                     /* and then the upper bound, tEnd. */
-                    Contacts::const_iterator t_end =
-                        std::upper_bound(t_begin,
-                                         it->second.end(),
-                                         tEnd,
-                                         CompareContact());
+                    const int *t_end =
+                        contactsUpperBound(t_begin, data.End(e), tEnd);
 
                     t0 = tBegin;
-                    t1 = (t_end-1)->t;
+                    t1 = *(t_end-1);
                 } else {
-                    t0 = t_begin->t;
+                    t0 = *t_begin;
                     t1 = tEnd;
                 }
 
-                doShortestPaths(data,
-                                it->first,
+                doShortestPaths(index,
+                                data,
+                                neighbour,
                                 t0,
                                 t1,
-                                visitedNodes,
+                                path,
                                 distance + 1,
                                 ingoing,
                                 result);
             }
         }
     }
+
+    path.Leave(node);
 }
 
 extern "C" SEXP shortestPaths(
@@ -250,81 +484,116 @@ extern "C" SEXP shortestPaths(
     SEXP inEnd,
     SEXP outBegin,
     SEXP outEnd,
-    SEXP numberOfIdentifiers)
+    SEXP numberOfIdentifiers,
+    SEXP order)
 {
     const char *names[] = {"inDistance", "inRowid", "inIndex",
                            "outDistance", "outRowid", "outIndex", ""};
-    kvec_t(int) inRowid;
-    kvec_t(int) outRowid;
+    ContactsRowids inRowid;
+    ContactsRowids outRowid;
     kvec_t(int) inDistance;
     kvec_t(int) outDistance;
     kvec_t(int) inIndex;
     kvec_t(int) outIndex;
     SEXP result, vec;
-    /* Lookup for ingoing contacts. */
-    std::vector<std::map<int, Contacts> > ingoing(Rf_asInteger(numberOfIdentifiers));
+    /* Lookup for ingoing and outgoing contacts. */
+    ContactsIndex index;
 
-    /* Lookup for outfoing contacts. */
-    std::vector<std::map<int, Contacts> > outgoing(Rf_asInteger(numberOfIdentifiers));
+    ContactsWindows inWindows, outWindows;
 
     if (check_arguments(src, dst, t, root, inBegin, inEnd,
-                       outBegin, outEnd, numberOfIdentifiers))
+                        outBegin, outEnd, numberOfIdentifiers, order))
         Rf_error("Unable to calculate shortest paths");
 
-    buildContactsLookup(ingoing, outgoing, src, dst, t);
+    queryWindows(inWindows, inBegin, inEnd);
+    queryWindows(outWindows, outBegin, outEnd);
+    if (buildContactsIndex(index, src, dst, t,
+                           INTEGER(numberOfIdentifiers)[0],
+                           INTEGER(order)[0],
+                           &inWindows,
+                           &outWindows))
+        Rf_error("Unable to calculate shortest paths");
+
+    /* The nodes in the search path, shared by all roots. */
+    PathNodes path(INTEGER(numberOfIdentifiers)[0]);
+
+    /* The shortest paths from a root, shared by all roots. */
+    ShortestPaths paths(INTEGER(numberOfIdentifiers)[0]);
 
     R_xlen_t len = Rf_xlength(root);
-    kv_init(inRowid);
-    kv_init(outRowid);
+    std::vector<R_xlen_t> inFirst =
+        uniqueQueries(INTEGER(root), INTEGER(inBegin), INTEGER(inEnd), len);
+    std::vector<R_xlen_t> outFirst =
+        uniqueQueries(INTEGER(root), INTEGER(outBegin), INTEGER(outEnd), len);
+
+    /* The range of rows in the result for each query, used to
+     * scatter the result of a unique query to its duplicates. */
+    std::vector<size_t> inStart(len), inStop(len);
+    std::vector<size_t> outStart(len), outStop(len);
+
+    inRowid.Clear(index.Long());
+    outRowid.Clear(index.Long());
     kv_init(inDistance);
     kv_init(outDistance);
     kv_init(inIndex);
     kv_init(outIndex);
 
     for (R_xlen_t i = 0; i < len; ++i) {
-        /* Key: node, Value: first: distance, second: original
-         * rowid. */
-        std::map<int, std::pair<int, int> > ingoingShortestPaths;
-
-        /* Key: node, Value: first: distance, second: original
-         * rowid. */
-        std::map<int, std::pair<int, int> > outgoingShortestPaths;
-
-        doShortestPaths(ingoing,
-                        INTEGER(root)[i] - 1,
-                        INTEGER(inBegin)[i],
-                        INTEGER(inEnd)[i],
-                        std::set<int>(),
-                        1,
-                        true,
-                        ingoingShortestPaths);
-
-        for (std::map<int, std::pair<int, int> >::const_iterator it =
-                ingoingShortestPaths.begin();
-            it!=ingoingShortestPaths.end(); ++it)
-        {
-            kv_push(int, inDistance, it->second.first);
-            kv_push(int, inRowid, it->second.second);
-            kv_push(int, inIndex, i + 1);
-        }
-
-        doShortestPaths(outgoing,
-                        INTEGER(root)[i] - 1,
-                        INTEGER(outBegin)[i],
-                        INTEGER(outEnd)[i],
-                        std::set<int>(),
-                        1,
-                        false,
-                        outgoingShortestPaths);
-
-        for (std::map<int, std::pair<int, int> >::const_iterator it =
-                 outgoingShortestPaths.begin();
-            it!=outgoingShortestPaths.end(); ++it)
-        {
-            kv_push(int, outDistance, it->second.first);
-            kv_push(int, outRowid, it->second.second);
-            kv_push(int, outIndex, i + 1);
+        inStart[i] = kv_size(inIndex);
+        if (inFirst[i] != i) {
+            for (size_t j = inStart[inFirst[i]]; j < inStop[inFirst[i]]; ++j) {
+                kv_push(int, inDistance, kv_A(inDistance, j));
+                inRowid.Push(inRowid[j]);
+                kv_push(int, inIndex, i + 1);
+            }
+        } else {
+            paths.Clear();
+            doShortestPaths(index,
+                            index.ingoing,
+                            index.Internal(INTEGER(root)[i] - 1),
+                            INTEGER(inBegin)[i],
+                            INTEGER(inEnd)[i],
+                            path,
+                            1,
+                            true,
+                            paths);
+
+            const std::vector<int>& nodes = paths.Nodes();
+            for (size_t j = 0; j < nodes.size(); ++j) {
+                kv_push(int, inDistance, paths.Distance(nodes[j]));
+                inRowid.Push(paths.Rowid(nodes[j]));
+                kv_push(int, inIndex, i + 1);
+            }
+        }
+        inStop[i] = kv_size(inIndex);
+
+        outStart[i] = kv_size(outIndex);
+        if (outFirst[i] != i) {
+            for (size_t j = outStart[outFirst[i]]; j < outStop[outFirst[i]]; ++j) {
+                kv_push(int, outDistance, kv_A(outDistance, j));
+                outRowid.Push(outRowid[j]);
+                kv_push(int, outIndex, i + 1);
+            }
+        } else {
+            paths.Clear();
+            doShortestPaths(index,
+                            index.outgoing,
+                            index.Internal(INTEGER(root)[i] - 1),
+                            INTEGER(outBegin)[i],
+                            INTEGER(outEnd)[i],
+                            path,
+                            1,
+                            false,
+                            paths);
+
+            const std::vector<int>& nodes = paths.Nodes();
+            for (size_t j = 0; j < nodes.size(); ++j) {
+                kv_push(int, outDistance, paths.Distance(nodes[j]));
+                outRowid.Push(paths.Rowid(nodes[j]));
+                kv_push(int, outIndex, i + 1);
+            }
         }
+        outStop[i] = kv_size(outIndex);
     }
 
     PROTECT(result = Rf_mkNamed(VECSXP, names));
@@ -332,8 +601,7 @@ extern "C" SEXP shortestPaths(
     SET_VECTOR_ELT(result, 0, vec = Rf_allocVector(INTSXP, kv_size(inDistance)));
     memcpy(INTEGER(vec), &kv_A(inDistance, 0), kv_size(inDistance) * sizeof(int));
 
-    SET_VECTOR_ELT(result, 1, vec = Rf_allocVector(INTSXP, kv_size(inRowid)));
-    memcpy(INTEGER(vec), &kv_A(inRowid, 0), kv_size(inRowid) * sizeof(int));
+    SET_VECTOR_ELT(result, 1, inRowid.Alloc());
 
     SET_VECTOR_ELT(result, 2, vec = Rf_allocVector(INTSXP, kv_size(inIndex)));
     memcpy(INTEGER(vec), &kv_A(inIndex, 0), kv_size(inIndex) * sizeof(int));
@@ -341,15 +609,12 @@ extern "C" SEXP shortestPaths(
     SET_VECTOR_ELT(result, 3, vec = Rf_allocVector(INTSXP, kv_size(outDistance)));
     memcpy(INTEGER(vec), &kv_A(outDistance, 0), kv_size(outDistance) * sizeof(int));
 
-    SET_VECTOR_ELT(result, 4, vec = Rf_allocVector(INTSXP, kv_size(outRowid)));
-    memcpy(INTEGER(vec), &kv_A(outRowid, 0), kv_size(outRowid) * sizeof(int));
+    SET_VECTOR_ELT(result, 4, outRowid.Alloc());
 
     SET_VECTOR_ELT(result, 5, vec = Rf_allocVector(INTSXP, kv_size(outIndex)));
     memcpy(INTEGER(vec), &kv_A(outIndex, 0), kv_size(outIndex) * sizeof(int));
 
 cleanup:
-    kv_destroy(inRowid);
-    kv_destroy(outRowid);
     kv_destroy(inDistance);
     kv_destroy(outDistance);
     kv_destroy(inIndex);
@@ -361,47 +626,43 @@ cleanup:
 }
 
 static void
-doTraceContacts(const std::vector<std::map<int, Contacts> >& data,
+doTraceContacts(const ContactsLookup& data,
                 const int node,
                 const int tBegin,
                 const int tEnd,
-                std::set<int> visitedNodes,
+                PathNodes& path,
                 const int distance,
                 const bool ingoing,
-                std::vector<int>& resultRowid,
+                ContactsRowids& resultRowid,
                 std::vector<int>& resultDistance,
                 const int maxDistance)
 {
-    visitedNodes.insert(node);
+    path.Enter(node);
+
+    ContactsEdges edges(data, node, tBegin, tEnd);
+    for (int i = 0; i < edges.Size(); ++i) {
+        int e = edges[i];
+        int neighbour = data.neighbour[e];
 
-    for (std::map<int, Contacts>::const_iterator it = data[node].begin(),
-            end = data[node].end(); it != end; ++it)
-    {
         /* We are not interested in going in loops or backwards in the
          * search path. */
-        if (visitedNodes.find(it->first) == visitedNodes.end()) {
+        if (!path.Contains(neighbour)) {
             /* We are only interested in contacts within the specified
              * time period, so first check the lower bound, tBegin. */
-            Contacts::const_iterator t_begin =
-                std::lower_bound(it->second.begin(),
-                                 it->second.end(),
-                                 tBegin,
-                                 CompareContact());
+            const int *t_begin =
+                contactsLowerBound(data.Begin(e), data.End(e), tBegin);
 
-            if (t_begin != it->second.end() && t_begin->t <= tEnd) {
+            if (t_begin != data.End(e) && *t_begin <= tEnd) {
                 int t0, t1;
 
                 /* and then the upper bound, tEnd. */
-                Contacts::const_iterator t_end =
-                    std::upper_bound(t_begin,
-                                     it->second.end(),
-                                     tEnd,
-                                     CompareContact());
+                const int *t_end =
+                    contactsUpperBound(t_begin, data.End(e), tEnd);
 
-                for (Contacts::const_iterator iit=t_begin; iit!=t_end; ++iit) {
+                for (const int *iit = t_begin; iit != t_end; ++iit) {
                     /* Increment with one since R vector is
                      * one-based. */
-                    resultRowid.push_back(iit->rowid + 1);
+                    resultRowid.Push(data.Rowid(iit) + 1);
 
                     resultDistance.push_back(distance);
                 }
@@ -411,17 +672,17 @@ doTraceContacts(const std::vector<std::map<int, Contacts> >& data,
 
                 if (ingoing) {
                     t0 = tBegin;
-                    t1 = (t_end-1)->t;
+                    t1 = *(t_end-1);
                 } else {
-                    t0 = t_begin->t;
+                    t0 = *t_begin;
                     t1 = tEnd;
                 }
 
                 doTraceContacts(data,
-                                it->first,
+                                neighbour,
                                 t0,
                                 t1,
-                                visitedNodes,
+                                path,
                                 distance + 1,
                                 ingoing,
                                 resultRowid,
@@ -430,6 +691,8 @@ doTraceContacts(const std::vector<std::map<int, Contacts> >& data,
             }
         }
     }
+
+    path.Leave(node);
 }
 
 extern "C" SEXP traceContacts(
@@ -442,70 +705,95 @@ extern "C" SEXP traceContacts(
     SEXP outBegin,
     SEXP outEnd,
     SEXP numberOfIdentifiers,
-    SEXP maxDistance)
+    SEXP maxDistance,
+    SEXP order)
 {
-    /* Lookup for ingoing contacts. */
-    std::vector<std::map<int, Contacts> > ingoing(Rf_asInteger(numberOfIdentifiers));
+    /* Lookup for ingoing and outgoing contacts. */
+    ContactsIndex index;
 
-    /* Lookup for outfoing contacts. */
-    std::vector<std::map<int, Contacts> > outgoing(Rf_asInteger(numberOfIdentifiers));
+    ContactsWindows inWindows, outWindows;
 
     if (check_arguments(src, dst, t, root, inBegin, inEnd, outBegin, outEnd,
-                        numberOfIdentifiers)) {
+                        numberOfIdentifiers, order)) {
+        Rf_error("Unable to trace contacts");
+    }
+
+    queryWindows(inWindows, inBegin, inEnd);
+    queryWindows(outWindows, outBegin, outEnd);
+    if (buildContactsIndex(index, src, dst, t,
+                           INTEGER(numberOfIdentifiers)[0],
+                           INTEGER(order)[0],
+                           &inWindows,
+                           &outWindows)) {
         Rf_error("Unable to trace contacts");
     }
 
-    buildContactsLookup(ingoing, outgoing, src, dst, t);
+    /* The nodes in the search path, shared by all roots. */
+    PathNodes path(INTEGER(numberOfIdentifiers)[0]);
 
     SEXP result, vec;
-    std::vector<int> resultRowid;
+    ContactsRowids resultRowid;
     std::vector<int> resultDistance;
 
-    PROTECT(result = Rf_allocVector(VECSXP, 4 * Rf_xlength(root)));
-    for (R_xlen_t i = 0, end = Rf_xlength(root); i < end; ++i) {
-        resultRowid.clear();
-        resultDistance.clear();
-
-        doTraceContacts(ingoing,
-                        INTEGER(root)[i] - 1,
-                        INTEGER(inBegin)[i],
-                        INTEGER(inEnd)[i],
-                        std::set<int>(),
-                        1,
-                        true,
-                        resultRowid,
-                        resultDistance,
-                        INTEGER(maxDistance)[0]);
-
-        SET_VECTOR_ELT(result, 4 * i, vec = Rf_allocVector(INTSXP, resultRowid.size()));
-        for (size_t j = 0; j < resultRowid.size(); ++j)
-            INTEGER(vec)[j] = resultRowid[j];
-
-        SET_VECTOR_ELT(result, 4 * i + 1, vec = Rf_allocVector(INTSXP, resultDistance.size()));
-        for (size_t j = 0; j < resultDistance.size(); ++j)
-            INTEGER(vec)[j] = resultDistance[j];
-
-        resultRowid.clear();
-        resultDistance.clear();
-
-        doTraceContacts(outgoing,
-                        INTEGER(root)[i] - 1,
-                        INTEGER(outBegin)[i],
-                        INTEGER(outEnd)[i],
-                        std::set<int>(),
-                        1,
-                        false,
-                        resultRowid,
-                        resultDistance,
-                        INTEGER(maxDistance)[0]);
-
-        SET_VECTOR_ELT(result, 4 * i + 2, vec = Rf_allocVector(INTSXP, resultRowid.size()));
-        for (size_t j = 0; j < resultRowid.size(); ++j)
-            INTEGER(vec)[j] = resultRowid[j];
-
-        SET_VECTOR_ELT(result, 4 * i + 3, vec = Rf_allocVector(INTSXP, resultDistance.size()));
-        for (size_t j = 0; j < resultDistance.size(); ++j)
-            INTEGER(vec)[j] = resultDistance[j];
+    R_xlen_t len = Rf_xlength(root);
+    std::vector<R_xlen_t> inFirst =
+        uniqueQueries(INTEGER(root), INTEGER(inBegin), INTEGER(inEnd), len);
+    std::vector<R_xlen_t> outFirst =
+        uniqueQueries(INTEGER(root), INTEGER(outBegin), INTEGER(outEnd), len);
+
+    PROTECT(result = Rf_allocVector(VECSXP, 4 * len));
+    for (R_xlen_t i = 0; i < len; ++i) {
+        if (inFirst[i] != i) {
+            /* Reuse the result from the identical ingoing query. */
+            SET_VECTOR_ELT(result, 4 * i, VECTOR_ELT(result, 4 * inFirst[i]));
+            SET_VECTOR_ELT(result, 4 * i + 1, VECTOR_ELT(result, 4 * inFirst[i] + 1));
+        } else {
+            resultRowid.Clear(index.Long());
+            resultDistance.clear();
+
+            doTraceContacts(index.ingoing,
+                            index.Internal(INTEGER(root)[i] - 1),
+                            INTEGER(inBegin)[i],
+                            INTEGER(inEnd)[i],
+                            path,
+                            1,
+                            true,
+                            resultRowid,
+                            resultDistance,
+                            INTEGER(maxDistance)[0]);
+
+            SET_VECTOR_ELT(result, 4 * i, resultRowid.Alloc());
+
+            SET_VECTOR_ELT(result, 4 * i + 1, vec = Rf_allocVector(INTSXP, resultDistance.size()));
+            for (size_t j = 0; j < resultDistance.size(); ++j)
+                INTEGER(vec)[j] = resultDistance[j];
+        }
+
+        if (outFirst[i] != i) {
+            /* Reuse the result from the identical outgoing query. */
+            SET_VECTOR_ELT(result, 4 * i + 2, VECTOR_ELT(result, 4 * outFirst[i] + 2));
+            SET_VECTOR_ELT(result, 4 * i + 3, VECTOR_ELT(result, 4 * outFirst[i] + 3));
+        } else {
+            resultRowid.Clear(index.Long());
+            resultDistance.clear();
+
+            doTraceContacts(index.outgoing,
+                            index.Internal(INTEGER(root)[i] - 1),
+                            INTEGER(outBegin)[i],
+                            INTEGER(outEnd)[i],
+                            path,
+                            1,
+                            false,
+                            resultRowid,
+                            resultDistance,
+                            INTEGER(maxDistance)[0]);
+
+            SET_VECTOR_ELT(result, 4 * i + 2, resultRowid.Alloc());
+
+            SET_VECTOR_ELT(result, 4 * i + 3, vec = Rf_allocVector(INTSXP, resultDistance.size()));
+            for (size_t j = 0; j < resultDistance.size(); ++j)
+                INTEGER(vec)[j] = resultDistance[j];
+        }
     }
 
 cleanup:
@@ -514,29 +802,500 @@ cleanup:
     return result;
 }
 
+/* Help class to trace the contacts of many roots into fragments that
+ * are shared between the roots, see traceFragments. The rows of a
+ * subtree of the search only depend on the node, the time window and
+ * the remaining distance, unless a contact of the subtree is blocked
+ * by a node higher up in the search path. Such a subtree is traced
+ * once into a fragment, and the fragment is referenced instead of
+ * traced again when the same state is reached from another root,
+ * provided that none of the nodes in the fragment are in the current
+ * search path. Then the rows are the same as from doTraceContacts
+ * when the references are expanded in place. */
+class TraceFragments {
+public:
+    TraceFragments(size_t numberOfIdentifiers, int maxDistance)
+        : maxDistance(maxDistance),
+          epoch(0),
+          path(numberOfIdentifiers, -1)
+        {}
+
+    ~TraceFragments() {
+        for (size_t i = 0; i < levels.size(); ++i)
+            delete levels[i];
+    }
+
+    /* Trace the contacts of the internal root and return the
+     * fragment with the contacts. */
+    int Trace(const ContactsLookup& data,
+              int root,
+              int tBegin,
+              int tEnd,
+              bool ingoing)
+    {
+        Key key = MakeKey(root, tBegin, tEnd, 1, ingoing);
+        int fragment = Lookup(key);
+
+        if (fragment < 0) {
+            Visit(data, root, tBegin, tEnd, 1, 0, ingoing);
+            fragment = Insert(key, *levels[0]);
+        }
+
+        fragments[fragment].root = true;
+
+        return fragment;
+    }
+
+    /* Number the fragments that are referenced by a root or from
+     * more than one place, and the other fragments are expanded in
+     * place. The numbering is in the order the fragments were traced,
+     * so a fragment is numbered after the fragments it references. */
+    void Number(void) {
+        int n = 0;
+
+        for (size_t i = 0; i < fragments.size(); ++i) {
+            if (fragments[i].root || fragments[i].references > 1)
+                fragments[i].number = n++;
+        }
+    }
+
+    /* The number of a fragment, see Number. */
+    int Numbered(int fragment) const {
+        return fragments[fragment].number;
+    }
+
+    /* Append the rows and references of a numbered fragment.
+     * References have a rowid of zero and are the number of the
+     * fragment and the distance to add to its rows. Rows have a
+     * child of -1. */
+    void Items(int fragment,
+               int distance,
+               ContactsRowids& rowid,
+               std::vector<int>& child,
+               std::vector<int>& result) const
+    {
+        const Fragment& f = fragments[fragment];
+
+        for (size_t i = f.begin; i < f.end; ++i) {
+            const Item& item = items[i];
+
+            if (item.child < 0) {
+                rowid.Push(item.rowid);
+                child.push_back(-1);
+                result.push_back(item.distance + distance);
+            } else if (fragments[item.child].number >= 0) {
+                rowid.Push(0);
+                child.push_back(fragments[item.child].number);
+                result.push_back(item.distance + distance);
+            } else {
+                Items(item.child, item.distance + distance,
+                      rowid, child, result);
+            }
+        }
+    }
+
+    /* The number of fragments, numbered or not. */
+    int N(void) const {
+        return fragments.size();
+    }
+
+private:
+    /* A one-based row, or a reference to a fragment when child is
+     * not -1. The distance of a row is relative to the root of the
+     * fragment, and of a reference the distance to add to the rows
+     * of the child. */
+    struct Item {
+        R_xlen_t rowid;
+        int child;
+        int distance;
+    };
+
+    /* The state of a subtree, where remaining is the number of
+     * levels left to the maxDistance. The time window is the fixed
+     * and the moving bound as in ContactChainCache. */
+    struct Key {
+        int node;
+        bool ingoing;
+        int remaining;
+        int fixed;
+        int moving;
+
+        bool operator<(const Key& other) const {
+            if (node != other.node)
+                return node < other.node;
+            if (ingoing != other.ingoing)
+                return ingoing < other.ingoing;
+            if (remaining != other.remaining)
+                return remaining < other.remaining;
+            if (fixed != other.fixed)
+                return fixed < other.fixed;
+            return moving < other.moving;
+        }
+    };
+
+    /* A traced fragment, that is valid for the moving bounds from the
+     * key up to last, see lastMovingBound. */
+    struct Entry {
+        int fragment;
+        int last;
+    };
+
+    /* The items and the contacted nodes, excluding the nodes of the
+     * referenced fragments, of a fragment. */
+    struct Fragment {
+        size_t begin;
+        size_t end;
+        size_t nodesBegin;
+        size_t nodesEnd;
+        int references;
+        bool root;
+        int number;
+        int epoch;
+    };
+
+    /* The work memory of a depth in the search. */
+    struct Level {
+        std::vector<Item> items;
+        std::vector<int> nodes;
+        int last;
+    };
+
+    int maxDistance;
+    int epoch;
+
+    /* The depth of the nodes in the search path, or -1. */
+    std::vector<int> path;
+
+    /* The levels are reused by depth. */
+    std::vector<Level*> levels;
+
+    std::vector<Item> items;
+    std::vector<int> nodes;
+    std::vector<Fragment> fragments;
+    std::map<Key, Entry> cache;
+
+    Key MakeKey(int node, int tBegin, int tEnd, int distance,
+                bool ingoing) const
+    {
+        Key key = {node, ingoing, maxDistance > 0 ? maxDistance - distance : 0,
+                   ingoing ? tBegin : tEnd, ingoing ? -tEnd : tBegin};
+        return key;
+    }
+
+    /* The fragment that was traced from the same state, or -1. */
+    int Lookup(const Key& key) const {
+        std::map<Key, Entry>::const_iterator it = cache.upper_bound(key);
+
+        if (it == cache.begin())
+            return -1;
+        --it;
+        if (it->first.node != key.node ||
+            it->first.ingoing != key.ingoing ||
+            it->first.remaining != key.remaining ||
+            it->first.fixed != key.fixed ||
+            it->second.last < key.moving)
+            return -1;
+
+        return it->second.fragment;
+    }
+
+    /* Trace the contacts of the node into the level of the depth, in
+     * the same way as doTraceContacts. Returns the smallest depth of
+     * a node in the search path that blocked a contact, or
+     * INT_MAX. */
+    int Visit(const ContactsLookup& data,
+              const int node,
+              const int tBegin,
+              const int tEnd,
+              const int distance,
+              const size_t depth,
+              const bool ingoing)
+    {
+        int blocked = INT_MAX;
+
+        if (depth == levels.size())
+            levels.push_back(new Level);
+        levels[depth]->items.clear();
+        levels[depth]->nodes.clear();
+        levels[depth]->last = INT_MAX;
+        path[node] = depth;
+
+        ContactsEdges edges(data, node, tBegin, tEnd);
+        for (int i = 0; i < edges.Size(); ++i) {
+            int e = edges[i];
+            int neighbour = data.neighbour[e];
+
+            /* We are only interested in contacts within the specified
+             * time period, so first check the lower bound, tBegin. */
+            const int *t_begin =
+                contactsLowerBound(data.Begin(e), data.End(e), tBegin);
+
+            if (t_begin == data.End(e) || *t_begin > tEnd)
+                continue;
+
+            /* and then the upper bound, tEnd. */
+            const int *t_end =
+                contactsUpperBound(t_begin, data.End(e), tEnd);
+
+            Level& level = *levels[depth];
+            if (ingoing && -*(t_end-1) < level.last)
+                level.last = -*(t_end-1);
+            else if (!ingoing && *t_begin < level.last)
+                level.last = *t_begin;
+
+            /* We are not interested in going in loops or backwards in
+             * the search path. */
+            if (path[neighbour] >= 0) {
+                if (path[neighbour] < blocked)
+                    blocked = path[neighbour];
+                continue;
+            }
+
+            int t0, t1;
+            for (const int *iit = t_begin; iit != t_end; ++iit) {
+                /* Increment with one since R vector is one-based. */
+                Item item = {data.Rowid(iit) + 1, -1, 1};
+                level.items.push_back(item);
+            }
+            level.nodes.push_back(neighbour);
+
+            if (maxDistance > 0 && distance >= maxDistance)
+                continue;
+
+            if (ingoing) {
+                t0 = tBegin;
+                t1 = *(t_end-1);
+            } else {
+                t0 = *t_begin;
+                t1 = tEnd;
+            }
+
+            Key key = MakeKey(neighbour, t0, t1, distance + 1, ingoing);
+            int fragment = Lookup(key);
+            if (fragment >= 0 && Disjoint(fragment)) {
+                Item item = {0, fragment, 1};
+                level.items.push_back(item);
+                fragments[fragment].references++;
+                continue;
+            }
+
+            int b = Visit(data, neighbour, t0, t1, distance + 1, depth + 1,
+                          ingoing);
+            if (b < blocked)
+                blocked = b;
+
+            Level& child = *levels[depth + 1];
+            Level& parent = *levels[depth];
+            if (b >= static_cast<int>(depth + 1) && child.items.size() > 1) {
+                /* The subtree is independent of the search path above
+                 * it, so keep it as a fragment. */
+                Item item = {0, Insert(key, child), 1};
+                parent.items.push_back(item);
+            } else {
+                for (size_t j = 0; j < child.items.size(); ++j) {
+                    Item item = child.items[j];
+                    item.distance++;
+                    parent.items.push_back(item);
+                }
+                parent.nodes.insert(parent.nodes.end(),
+                                    child.nodes.begin(),
+                                    child.nodes.end());
+            }
+        }
+
+        path[node] = -1;
+
+        return blocked;
+    }
+
+    int Insert(const Key& key, Level& level) {
+        Fragment fragment;
+
+        std::sort(level.nodes.begin(), level.nodes.end());
+        level.nodes.erase(std::unique(level.nodes.begin(), level.nodes.end()),
+                          level.nodes.end());
+
+        fragment.begin = items.size();
+        items.insert(items.end(), level.items.begin(), level.items.end());
+        fragment.end = items.size();
+        fragment.nodesBegin = nodes.size();
+        nodes.insert(nodes.end(), level.nodes.begin(), level.nodes.end());
+        fragment.nodesEnd = nodes.size();
+        fragment.references = 1;
+        fragment.root = false;
+        fragment.number = -1;
+        fragment.epoch = 0;
+        fragments.push_back(fragment);
+
+        Entry entry = {static_cast<int>(fragments.size() - 1), level.last};
+        cache[key] = entry;
+
+        return fragments.size() - 1;
+    }
+
+    /* Check that none of the nodes in the fragment, or in the
+     * fragments it references, are in the search path. */
+    bool Disjoint(int fragment) {
+        if (epoch == INT_MAX) {
+            for (size_t i = 0; i < fragments.size(); ++i)
+                fragments[i].epoch = 0;
+            epoch = 0;
+        }
+        epoch++;
+
+        return DisjointFragment(fragment);
+    }
+
+    bool DisjointFragment(int fragment) {
+        Fragment& f = fragments[fragment];
+
+        if (f.epoch == epoch)
+            return true;
+        f.epoch = epoch;
+
+        for (size_t i = f.nodesBegin; i < f.nodesEnd; ++i) {
+            if (path[nodes[i]] >= 0)
+                return false;
+        }
+
+        for (size_t i = f.begin; i < f.end; ++i) {
+            if (items[i].child >= 0 && !DisjointFragment(items[i].child))
+                return false;
+        }
+
+        return true;
+    }
+
+    TraceFragments(const TraceFragments&);
+    TraceFragments& operator=(const TraceFragments&);
+};
+
+extern "C" SEXP traceFragments(
+    SEXP src,
+    SEXP dst,
+    SEXP t,
+    SEXP root,
+    SEXP inBegin,
+    SEXP inEnd,
+    SEXP outBegin,
+    SEXP outEnd,
+    SEXP numberOfIdentifiers,
+    SEXP maxDistance,
+    SEXP order)
+{
+    const char *names[] = {"ingoing", "outgoing", "fragment", "rowid",
+                           "child", "distance", ""};
+
+    /* Lookup for ingoing and outgoing contacts. */
+    ContactsIndex index;
+
+    ContactsWindows inWindows, outWindows;
+
+    if (check_arguments(src, dst, t, root, inBegin, inEnd, outBegin, outEnd,
+                        numberOfIdentifiers, order)) {
+        Rf_error("Unable to trace contacts");
+    }
+
+    queryWindows(inWindows, inBegin, inEnd);
+    queryWindows(outWindows, outBegin, outEnd);
+    if (buildContactsIndex(index, src, dst, t,
+                           INTEGER(numberOfIdentifiers)[0],
+                           INTEGER(order)[0],
+                           &inWindows,
+                           &outWindows)) {
+        Rf_error("Unable to trace contacts");
+    }
+
+    TraceFragments fragments(INTEGER(numberOfIdentifiers)[0],
+                             INTEGER(maxDistance)[0]);
+
+    R_xlen_t len = Rf_xlength(root);
+    std::vector<int> ingoing(len), outgoing(len);
+    for (R_xlen_t i = 0; i < len; ++i) {
+        int node = index.Internal(INTEGER(root)[i] - 1);
+
+        ingoing[i] = fragments.Trace(index.ingoing, node,
+                                     INTEGER(inBegin)[i],
+                                     INTEGER(inEnd)[i],
+                                     true);
+        outgoing[i] = fragments.Trace(index.outgoing, node,
+                                      INTEGER(outBegin)[i],
+                                      INTEGER(outEnd)[i],
+                                      false);
+    }
+
+    /* Expand the fragments that are only referenced once into the
+     * referencing fragment. */
+    std::vector<int> fragment;
+    ContactsRowids rowid;
+    std::vector<int> child;
+    std::vector<int> distance;
+    rowid.Clear(index.Long());
+    fragments.Number();
+    for (int i = 0; i < fragments.N(); ++i) {
+        if (fragments.Numbered(i) >= 0) {
+            fragments.Items(i, 0, rowid, child, distance);
+            fragment.resize(rowid.Size(), fragments.Numbered(i) + 1);
+        }
+    }
+
+    SEXP result, vec;
+    PROTECT(result = Rf_mkNamed(VECSXP, names));
+
+    SET_VECTOR_ELT(result, 0, vec = Rf_allocVector(INTSXP, len));
+    for (R_xlen_t i = 0; i < len; ++i)
+        INTEGER(vec)[i] = fragments.Numbered(ingoing[i]) + 1;
+
+    SET_VECTOR_ELT(result, 1, vec = Rf_allocVector(INTSXP, len));
+    for (R_xlen_t i = 0; i < len; ++i)
+        INTEGER(vec)[i] = fragments.Numbered(outgoing[i]) + 1;
+
+    SET_VECTOR_ELT(result, 2, vec = Rf_allocVector(INTSXP, fragment.size()));
+    for (size_t i = 0; i < fragment.size(); ++i)
+        INTEGER(vec)[i] = fragment[i];
+
+    SET_VECTOR_ELT(result, 3, vec = rowid.Alloc());
+    for (size_t i = 0; i < rowid.Size(); ++i) {
+        if (child[i] >= 0) {
+            if (index.Long())
+                REAL(vec)[i] = NA_REAL;
+            else
+                INTEGER(vec)[i] = NA_INTEGER;
+        }
+    }
+
+    SET_VECTOR_ELT(result, 4, vec = Rf_allocVector(INTSXP, child.size()));
+    for (size_t i = 0; i < child.size(); ++i)
+        INTEGER(vec)[i] = child[i] < 0 ? NA_INTEGER : child[i] + 1;
+
+    SET_VECTOR_ELT(result, 5, vec = Rf_allocVector(INTSXP, distance.size()));
+    for (size_t i = 0; i < distance.size(); ++i)
+        INTEGER(vec)[i] = distance[i];
+
+    UNPROTECT(1);
+
+    return result;
+}
+
 static int
-degree(const std::vector<std::map<int, Contacts> >& data,
+degree(const ContactsLookup& data,
        const int node,
        const int tBegin,
        const int tEnd)
 {
     int result = 0;
 
-    for (std::map<int, Contacts>::const_iterator it = data[node].begin();
-        it != data[node].end();
-        ++it)
-    {
+    ContactsEdges edges(data, node, tBegin, tEnd);
+    for (int i = 0; i < edges.Size(); ++i) {
+        int e = edges[i];
         /* We are not interested in going in loops. */
-        if (node != it->first) {
+        if (node != data.neighbour[e]) {
             /* We are only interested in contacts within the specified
              * time period, so first check the lower bound, tBegin. */
-            Contacts::const_iterator t_begin =
-                std::lower_bound(it->second.begin(),
-                                 it->second.end(),
-                                 tBegin,
-                                 CompareContact());
+            const int *t_begin =
+                contactsLowerBound(data.Begin(e), data.End(e), tBegin);
 
-            if (t_begin != it->second.end() && t_begin->t <= tEnd) {
+            if (t_begin != data.End(e) && *t_begin <= tEnd) {
                 ++result;
             }
         }
@@ -545,52 +1304,139 @@ degree(const std::vector<std::map<int, Contacts> >& data,
     return result;
 }
 
+/* The last moving bound, see ContactChainCache, for which a
+ * traversal from node gives the same result as from the moving bound
+ * of the time window, i.e. the first contact from the node in the
+ * time window for outgoing contacts and the last contact to the node
+ * in the time window for ingoing contacts. */
+static int
+lastMovingBound(const ContactsLookup& data,
+                const int node,
+                const int tBegin,
+                const int tEnd,
+                const bool ingoing)
+{
+    int result = INT_MAX;
+
+    ContactsEdges edges(data, node, tBegin, tEnd);
+    for (int i = 0; i < edges.Size(); ++i) {
+        int e = edges[i];
+        const int *t_begin =
+            contactsLowerBound(data.Begin(e), data.End(e), tBegin);
+
+        if (t_begin != data.End(e) && *t_begin <= tEnd) {
+            if (ingoing) {
+                const int *t_end =
+                    contactsUpperBound(t_begin, data.End(e), tEnd);
+
+                if (-*(t_end-1) < result)
+                    result = -*(t_end-1);
+            } else if (*t_begin < result) {
+                result = *t_begin;
+            }
+        }
+    }
+
+    return result;
+}
+
 static void
-contactChain(const std::vector<std::map<int, Contacts> >& data,
+contactChain(const ContactsLookup& data,
 	     const int node,
 	     const int tBegin,
 	     const int tEnd,
 	     VisitedNodes& visitedNodes,
-	     const bool ingoing)
+	     const bool ingoing,
+	     ContactChainCache *cache)
 {
     visitedNodes.Update(node, tBegin, tEnd, ingoing);
 
-    for (std::map<int, Contacts>::const_iterator it = data[node].begin(),
-            end = data[node].end(); it != end; ++it)
-    {
-        if (visitedNodes.Visit(it->first, tBegin, tEnd, ingoing)) {
+    ContactsEdges edges(data, node, tBegin, tEnd);
+    for (int i = 0; i < edges.Size(); ++i) {
+        int e = edges[i];
+        int neighbour = data.neighbour[e];
+
+        if (visitedNodes.Visit(neighbour, tBegin, tEnd, ingoing)) {
             /* We are only interested in contacts within the specified
              * time period, so first check the lower bound, tBegin. */
-            Contacts::const_iterator t_begin =
-                std::lower_bound(it->second.begin(),
-                                 it->second.end(),
-                                 tBegin,
-                                 CompareContact());
+            const int *t_begin =
+                contactsLowerBound(data.Begin(e), data.End(e), tBegin);
 
-            if (t_begin != it->second.end() && t_begin->t <= tEnd) {
+            if (t_begin != data.End(e) && *t_begin <= tEnd) {
                 int t0, t1;
 
                 if (ingoing) {
                     /* and then the upper bound, tEnd. */
-                    Contacts::const_iterator t_end =
-                        std::upper_bound(t_begin,
-                                         it->second.end(),
-                                         tEnd,
-                                         CompareContact());
+                    const int *t_end =
+                        contactsUpperBound(t_begin, data.End(e), tEnd);
 
                     t0 = tBegin;
-                    t1 = (t_end-1)->t;
+                    t1 = *(t_end-1);
                 } else {
-                    t0 = t_begin->t;
+                    t0 = *t_begin;
                     t1 = tEnd;
                 }
 
-                contactChain(data, it->first, t0, t1, visitedNodes, ingoing);
+                const ContactChainCache::Chain *chain = NULL;
+                if (cache)
+                    chain = cache->Lookup(neighbour, t0, t1, ingoing);
+
+                if (chain) {
+                    /* Adopt the contact chain of the node instead of
+                     * tracing it again. */
+                    visitedNodes.Update(neighbour, t0, t1, ingoing);
+                    for (ContactChainCache::Chain::const_iterator
+                             iit = chain->begin(); iit != chain->end(); ++iit) {
+                        visitedNodes.Update(iit->first, iit->second,
+                                            iit->second, ingoing);
+                    }
+                } else {
+                    contactChain(data, neighbour, t0, t1, visitedNodes,
+                                 ingoing, cache);
+                }
             }
         }
     }
 }
 
+/* Trace the contact chain from root and return the number of nodes
+ * in it, excluding the root. */
+static int
+contactChainSize(const ContactsLookup& data,
+                 const int root,
+                 const int tBegin,
+                 const int tEnd,
+                 VisitedNodes& visitedNodes,
+                 const bool ingoing,
+                 ContactChainCache *cache)
+{
+    if (cache) {
+        const ContactChainCache::Chain *chain =
+            cache->Lookup(root, tBegin, tEnd, ingoing);
+        if (chain)
+            return chain->size();
+    }
+
+    visitedNodes.Clear();
+    contactChain(data, root, tBegin, tEnd, visitedNodes, ingoing, cache);
+
+    if (cache) {
+        ContactChainCache::Chain chain;
+        for (std::vector<int>::const_iterator it = visitedNodes.Nodes().begin();
+             it != visitedNodes.Nodes().end(); ++it)
+        {
+            if (*it != root)
+                chain.push_back(std::make_pair(*it, visitedNodes.Bound(*it)));
+        }
+
+        cache->Insert(root, tBegin, tEnd,
+                      lastMovingBound(data, root, tBegin, tEnd, ingoing),
+                      ingoing, chain);
+    }
+
+    return visitedNodes.N() - 1;
+}
+
 extern "C" SEXP networkSummary(
     SEXP src,
     SEXP dst,
@@ -600,7 +1446,10 @@ extern "C" SEXP networkSummary(
     SEXP inEnd,
     SEXP outBegin,
     SEXP outEnd,
-    SEXP numberOfIdentifiers)
+    SEXP numberOfIdentifiers,
+    SEXP cacheSize,
+    SEXP order,
+    SEXP prepared)
 {
     const char *names[] = {"inDegree", "outDegree",
                            "ingoingContactChain", "outgoingContactChain", ""};
@@ -609,58 +1458,104 @@ extern "C" SEXP networkSummary(
     kvec_t(int) outgoingContactChain;
     kvec_t(int) inDegree;
     kvec_t(int) outDegree;
-    SEXP result, vec;
+    SEXP result = R_NilValue, vec;
+    R_xlen_t len;
+    std::vector<R_xlen_t> inFirst, outFirst;
+    ContactChainCache *ingoingCache = NULL;
+    ContactChainCache *outgoingCache = NULL;
 
-    /* Lookup for ingoing contacts. */
-    std::vector<std::map<int, Contacts> > ingoing(Rf_asInteger(numberOfIdentifiers));
+    /* Lookup for ingoing and outgoing contacts. */
+    ContactsIndex index;
+    ContactsWindows inWindows, outWindows;
 
-    /* Lookup for outfoing contacts. */
-    std::vector<std::map<int, Contacts> > outgoing(Rf_asInteger(numberOfIdentifiers));
-
-    error = check_arguments(src, dst, t, root, inBegin, inEnd,
-                            outBegin, outEnd, numberOfIdentifiers);
-    if (error)
-        goto cleanup;
+    /* The visited nodes, shared by all roots. */
+    VisitedNodes visitedNodes(0);
 
     kv_init(ingoingContactChain);
     kv_init(outgoingContactChain);
     kv_init(inDegree);
     kv_init(outDegree);
 
-    error = buildContactsLookup(ingoing, outgoing, src, dst, t);
-    if (error)
+    error = check_arguments(src, dst, t, root, inBegin, inEnd,
+                            outBegin, outEnd, numberOfIdentifiers, order);
+    if (error ||
+        !Rf_isInteger(cacheSize) ||
+        Rf_xlength(cacheSize) != 1 ||
+        INTEGER(cacheSize)[0] < 0) {
+        error = 1;
         goto cleanup;
+    }
 
-    for (R_xlen_t i = 0, end = Rf_xlength(root); i < end; ++i) {
-        VisitedNodes visitedNodesIngoing(INTEGER(numberOfIdentifiers)[0]);
-        VisitedNodes visitedNodesOutgoing(INTEGER(numberOfIdentifiers)[0]);
-
-        contactChain(ingoing,
-                     INTEGER(root)[i] - 1,
-                     INTEGER(inBegin)[i],
-                     INTEGER(inEnd)[i],
-                     visitedNodesIngoing,
-                     true);
+    /* Optional cache of contact chains, disabled when the size is
+     * zero. */
+    if (INTEGER(cacheSize)[0] > 0) {
+        ingoingCache = new ContactChainCache(INTEGER(cacheSize)[0]);
+        outgoingCache = new ContactChainCache(INTEGER(cacheSize)[0]);
+    }
 
-        contactChain(outgoing,
-                     INTEGER(root)[i] - 1,
-                     INTEGER(outBegin)[i],
-                     INTEGER(outEnd)[i],
-                     visitedNodesOutgoing,
-                     false);
+    if (Rf_isNull(prepared)) {
+        queryWindows(inWindows, inBegin, inEnd);
+        queryWindows(outWindows, outBegin, outEnd);
+        error = buildContactsIndex(index, src, dst, t,
+                                   INTEGER(numberOfIdentifiers)[0],
+                                   INTEGER(order)[0],
+                                   &inWindows,
+                                   &outWindows);
+    } else {
+        /* Adopt the prepared index from ContactsIndex. */
+        error = readContactsIndex(index, prepared) ||
+            index.N() != INTEGER(numberOfIdentifiers)[0];
+    }
+    if (error)
+        goto cleanup;
+    /* The visited nodes are only recorded for the cache. */
+    visitedNodes = VisitedNodes(INTEGER(numberOfIdentifiers)[0],
+                                INTEGER(cacheSize)[0] > 0);
 
-        kv_push(int, ingoingContactChain, visitedNodesIngoing.N() - 1);
-        kv_push(int, outgoingContactChain, visitedNodesOutgoing.N() - 1);
+    len = Rf_xlength(root);
+    inFirst = uniqueQueries(INTEGER(root), INTEGER(inBegin), INTEGER(inEnd), len);
+    outFirst = uniqueQueries(INTEGER(root), INTEGER(outBegin), INTEGER(outEnd), len);
 
-        kv_push(int, inDegree, degree(ingoing,
-                                      INTEGER(root)[i] - 1,
-                                      INTEGER(inBegin)[i],
-                                      INTEGER(inEnd)[i]));
+    for (R_xlen_t i = 0; i < len; ++i) {
+        if (inFirst[i] != i) {
+            /* Reuse the result from the identical ingoing query. */
+            kv_push(int, ingoingContactChain,
+                    kv_A(ingoingContactChain, inFirst[i]));
+            kv_push(int, inDegree, kv_A(inDegree, inFirst[i]));
+        } else {
+            kv_push(int, ingoingContactChain,
+                    contactChainSize(index.ingoing,
+                                     index.Internal(INTEGER(root)[i] - 1),
+                                     INTEGER(inBegin)[i],
+                                     INTEGER(inEnd)[i],
+                                     visitedNodes,
+                                     true,
+                                     ingoingCache));
+            kv_push(int, inDegree, degree(index.ingoing,
+                                          index.Internal(INTEGER(root)[i] - 1),
+                                          INTEGER(inBegin)[i],
+                                          INTEGER(inEnd)[i]));
+        }
 
-        kv_push(int, outDegree, degree(outgoing,
-                                       INTEGER(root)[i] - 1,
-                                       INTEGER(outBegin)[i],
-                                       INTEGER(outEnd)[i]));
+        if (outFirst[i] != i) {
+            /* Reuse the result from the identical outgoing query. */
+            kv_push(int, outgoingContactChain,
+                    kv_A(outgoingContactChain, outFirst[i]));
+            kv_push(int, outDegree, kv_A(outDegree, outFirst[i]));
+        } else {
+            kv_push(int, outgoingContactChain,
+                    contactChainSize(index.outgoing,
+                                     index.Internal(INTEGER(root)[i] - 1),
+                                     INTEGER(outBegin)[i],
+                                     INTEGER(outEnd)[i],
+                                     visitedNodes,
+                                     false,
+                                     outgoingCache));
+            kv_push(int, outDegree, degree(index.outgoing,
+                                           index.Internal(INTEGER(root)[i] - 1),
+                                           INTEGER(outBegin)[i],
+                                           INTEGER(outEnd)[i]));
+        }
     }
 
     PROTECT(result = Rf_mkNamed(VECSXP, names));
@@ -678,6 +1573,8 @@ extern "C" SEXP networkSummary(
     memcpy(INTEGER(vec), &kv_A(outgoingContactChain, 0), kv_size(outgoingContactChain) * sizeof(int));
 
 cleanup:
+    delete ingoingCache;
+    delete outgoingCache;
     kv_destroy(ingoingContactChain);
     kv_destroy(outgoingContactChain);
     kv_destroy(inDegree);
@@ -692,11 +1589,475 @@ cleanup:
     return result;
 }
 
+ContactsTracer::ContactsTracer(const ContactsIndex& index)
+    : index(index),
+      visitedNodes(new VisitedNodes(index.N())),
+      path(new PathNodes(index.N())),
+      paths(new ::ShortestPaths(index.N()))
+{
+}
+
+ContactsTracer::~ContactsTracer()
+{
+    delete visitedNodes;
+    delete path;
+    delete paths;
+}
+
+int contactsTracers(const ContactsIndex& index,
+                    int threads,
+                    std::vector<ContactsTracer*>& tracers)
+{
+    int n = contactsThreads(threads);
+
+    for (int i = 0; i < n; ++i)
+        tracers.push_back(new ContactsTracer(index));
+
+    return n;
+}
+
+void ContactsTracer::NetworkSummary(
+    int root,
+    int inBegin,
+    int inEnd,
+    int outBegin,
+    int outEnd,
+    int *result)
+{
+    int node = index.Internal(root);
+
+    result[0] = degree(index.ingoing, node, inBegin, inEnd);
+    result[1] = degree(index.outgoing, node, outBegin, outEnd);
+    result[2] = contactChainSize(index.ingoing, node, inBegin, inEnd,
+                                 *visitedNodes, true, NULL);
+    result[3] = contactChainSize(index.outgoing, node, outBegin, outEnd,
+                                 *visitedNodes, false, NULL);
+}
+
+int ContactsTracer::Degree(int root, int tBegin, int tEnd, bool ingoing)
+{
+    return degree(ingoing ? index.ingoing : index.outgoing,
+                  index.Internal(root), tBegin, tEnd);
+}
+
+int ContactsTracer::ContactChain(
+    int root,
+    int tBegin,
+    int tEnd,
+    bool ingoing,
+    const std::vector<int> *mask,
+    std::vector<int> *chain)
+{
+    const ContactsLookup& data = ingoing ? index.ingoing : index.outgoing;
+    int node = index.Internal(root);
+    int masked = 0;
+
+    visitedNodes->Record(chain != NULL);
+    if (!mask && !chain)
+        return contactChainSize(data, node, tBegin, tEnd,
+                                *visitedNodes, ingoing, NULL);
+
+    visitedNodes->Clear();
+    if (chain)
+        chain->clear();
+
+    /* Visit the masked nodes first with a bound that can't be
+     * improved, so that they are never traced through. */
+    if (mask) {
+        for (size_t i = 0; i < mask->size(); ++i) {
+            int v = index.Internal((*mask)[i]);
+
+            if (v == node)
+                return 0;
+            if (visitedNodes->Visit(v, tBegin, tEnd, ingoing)) {
+                visitedNodes->Update(v, INT_MIN, INT_MAX, ingoing);
+                masked++;
+            }
+        }
+    }
+
+    contactChain(data, node, tBegin, tEnd, *visitedNodes, ingoing, NULL);
+
+    if (chain) {
+        const std::vector<int>& nodes = visitedNodes->Nodes();
+
+        for (size_t i = masked + 1; i < nodes.size(); ++i)
+            chain->push_back(index.External(nodes[i]));
+    }
+
+    return visitedNodes->N() - 1 - masked;
+}
+
+/* The number of nodes reached from node on the coarse level of the
+ * lookup, in the periods [first, last] and the days [tBegin, tEnd],
+ * where the contacts from the root are after the period begin for
+ * the outgoing contacts, or before for the ingoing contacts. The
+ * contacts of a path are in non-decreasing periods, or increasing
+ * periods if strict. Each node is expanded once with its earliest
+ * period, or latest for the ingoing contacts, in the order of the
+ * periods, and only the edges with contacts in the days of the
+ * periods that can follow are checked. */
+static int
+coarseContactChain(const ContactsLookup& data,
+                   int node,
+                   int begin,
+                   int first,
+                   int last,
+                   int tBegin,
+                   int tEnd,
+                   bool strict,
+                   VisitedNodes& visitedNodes,
+                   bool ingoing,
+                   std::vector<std::pair<int, int> >& queue)
+{
+    const ContactsCoarse& coarse = data.coarse;
+    std::greater<std::pair<int, int> > later;
+    ContactsEdges edges;
+
+    visitedNodes.Clear();
+    queue.clear();
+    if (first > last)
+        return 0;
+
+    /* The queue is a heap on the period, negated for the ingoing
+     * contacts to expand the latest period first. */
+    visitedNodes.Update(node, begin, begin, ingoing);
+    queue.push_back(std::make_pair(ingoing ? -begin : begin, node));
+    while (!queue.empty()) {
+        int p = ingoing ? -queue.front().first : queue.front().first;
+        int v = queue.front().second;
+
+        std::pop_heap(queue.begin(), queue.end(), later);
+        queue.pop_back();
+        if (visitedNodes.Bound(v) != p)
+            continue;
+
+        /* The next period and its days. */
+        int q0 = ingoing ? (strict ? p - 1 : p) : (strict ? p + 1 : p);
+        if (ingoing) {
+            if (q0 < first)
+                continue;
+            edges.Reset(data, v, tBegin,
+                        std::min(tEnd, (q0 + 1) * coarse.width - 1));
+        } else {
+            if (q0 > last)
+                continue;
+            edges.Reset(data, v, std::max(tBegin, q0 * coarse.width), tEnd);
+        }
+
+        for (int i = 0; i < edges.Size(); ++i) {
+            int e = edges[i];
+            int neighbour = data.neighbour[e];
+            const int *q;
+
+            if (neighbour == v)
+                continue;
+
+            if (ingoing) {
+                q = contactsUpperBound(coarse.Begin(e), coarse.End(e), q0);
+                if (q == coarse.Begin(e) || *--q < first)
+                    continue;
+            } else {
+                q = contactsLowerBound(coarse.Begin(e), coarse.End(e), q0);
+                if (q == coarse.End(e) || *q > last)
+                    continue;
+            }
+
+            if (visitedNodes.Visit(neighbour, *q, *q, ingoing)) {
+                visitedNodes.Update(neighbour, *q, *q, ingoing);
+                queue.push_back(std::make_pair(ingoing ? -*q : *q, neighbour));
+                std::push_heap(queue.begin(), queue.end(), later);
+            }
+        }
+    }
+
+    return visitedNodes.N() - 1;
+}
+
+int ContactsTracer::ContactChainBound(
+    int root,
+    int tBegin,
+    int tEnd,
+    bool ingoing,
+    bool upper)
+{
+    const ContactsLookup& data = ingoing ? index.ingoing : index.outgoing;
+    const ContactsCoarse& coarse = data.coarse;
+    int node = index.Internal(root);
+    int first, last;
+
+    /* The periods that overlap the window. */
+    if (upper) {
+        first = coarse.Period(tBegin);
+        last = coarse.Period(tEnd);
+        return coarseContactChain(data, node, ingoing ? last : first,
+                                  first, last, tBegin, tEnd, false,
+                                  *visitedNodes, ingoing, queue);
+    }
+
+    /* The periods that are within the window. */
+    first = coarse.Period(tBegin - 1) + 1;
+    last = coarse.Period(tEnd + 1) - 1;
+    return coarseContactChain(data, node, ingoing ? last + 1 : first - 1,
+                              first, last, tBegin, tEnd, true,
+                              *visitedNodes, ingoing, queue);
+}
+
+void ContactsTracer::Trace(
+    int root,
+    int tBegin,
+    int tEnd,
+    bool ingoing,
+    int maxDistance,
+    ContactsRowids& rowid,
+    std::vector<int>& distance)
+{
+    rowid.Clear(index.Long());
+    distance.clear();
+    doTraceContacts(ingoing ? index.ingoing : index.outgoing,
+                    index.Internal(root),
+                    tBegin,
+                    tEnd,
+                    *path,
+                    1,
+                    ingoing,
+                    rowid,
+                    distance,
+                    maxDistance);
+}
+
+void ContactsTracer::ShortestPaths(
+    int root,
+    int tBegin,
+    int tEnd,
+    bool ingoing,
+    std::vector<int>& node,
+    std::vector<int>& distance)
+{
+    paths->Clear();
+    doShortestPaths(index,
+                    ingoing ? index.ingoing : index.outgoing,
+                    index.Internal(root),
+                    tBegin,
+                    tEnd,
+                    *path,
+                    1,
+                    ingoing,
+                    *paths);
+
+    node = paths->Nodes();
+    distance.resize(node.size());
+    for (size_t i = 0; i < node.size(); ++i)
+        distance[i] = paths->Distance(node[i]);
+}
+
+/* The state of a node on the stack of a TraceCursor, i.e. the local
+ * variables of doTraceContacts. */
+struct TraceCursor::Frame {
+    int node;
+    int tBegin;
+    int tEnd;
+    int distance;
+    ContactsEdges edges;
+
+    /* The next edge to check. */
+    int i;
+
+    /* The rows of the current edge that are not yielded. */
+    const int *first;
+    const int *last;
+
+    /* Trace the neighbour of the current edge in [t0, t1] when the
+     * rows are yielded. */
+    bool descend;
+    int neighbour;
+    int t0;
+    int t1;
+};
+
+TraceCursor::TraceCursor(const ContactsIndex& index, int maxDistance)
+    : index(index),
+      data(&index.outgoing),
+      maxDistance(maxDistance),
+      ingoing(false),
+      path(new PathNodes(index.N())),
+      depth(0)
+{
+}
+
+TraceCursor::~TraceCursor()
+{
+    while (depth)
+        path->Leave(frames[--depth]->node);
+    for (size_t i = 0; i < frames.size(); ++i)
+        delete frames[i];
+    delete path;
+}
+
+void TraceCursor::Push(int node, int tBegin, int tEnd, int distance)
+{
+    if (depth == frames.size())
+        frames.push_back(new Frame());
+
+    Frame& f = *frames[depth++];
+    f.node = node;
+    f.tBegin = tBegin;
+    f.tEnd = tEnd;
+    f.distance = distance;
+    f.edges.Reset(*data, node, tBegin, tEnd);
+    f.i = 0;
+    f.first = f.last = NULL;
+    f.descend = false;
+
+    path->Enter(node);
+}
+
+void TraceCursor::Start(int root, int tBegin, int tEnd, bool ingoing)
+{
+    while (depth)
+        path->Leave(frames[--depth]->node);
+
+    this->ingoing = ingoing;
+    data = ingoing ? &index.ingoing : &index.outgoing;
+    Push(index.Internal(root), tBegin, tEnd, 1);
+}
+
+size_t TraceCursor::Next(
+    size_t n,
+    ContactsRowids& rowid,
+    std::vector<int>& distance)
+{
+    size_t count = 0;
+
+    while (depth && count < n) {
+        Frame& f = *frames[depth - 1];
+
+        if (f.first != f.last) {
+            /* Increment with one since R vector is one-based. */
+            rowid.Push(data->Rowid(f.first++) + 1);
+            distance.push_back(f.distance);
+            count++;
+            continue;
+        }
+
+        if (f.descend) {
+            f.descend = false;
+            Push(f.neighbour, f.t0, f.t1, f.distance + 1);
+            continue;
+        }
+
+        if (f.i == f.edges.Size()) {
+            path->Leave(f.node);
+            depth--;
+            continue;
+        }
+
+        int e = f.edges[f.i++];
+        int neighbour = data->neighbour[e];
+
+        /* We are not interested in going in loops or backwards in the
+         * search path. */
+        if (path->Contains(neighbour))
+            continue;
+
+        const int *t_begin =
+            contactsLowerBound(data->Begin(e), data->End(e), f.tBegin);
+        if (t_begin == data->End(e) || *t_begin > f.tEnd)
+            continue;
+
+        const int *t_end =
+            contactsUpperBound(t_begin, data->End(e), f.tEnd);
+
+        f.first = t_begin;
+        f.last = t_end;
+        f.neighbour = neighbour;
+        f.descend = !(maxDistance > 0 && f.distance >= maxDistance);
+        if (ingoing) {
+            f.t0 = f.tBegin;
+            f.t1 = *(t_end-1);
+        } else {
+            f.t0 = *t_begin;
+            f.t1 = f.tEnd;
+        }
+    }
+
+    return count;
+}
+
+/* Defined in centrality.cpp */
+extern "C" SEXP contactsCentrality(SEXP, SEXP, SEXP, SEXP, SEXP);
+
+/* Defined in contacts.cpp */
+extern "C" SEXP contactsIndex(SEXP, SEXP, SEXP, SEXP, SEXP);
+
+/* Defined in coverage.cpp */
+extern "C" SEXP contactsCoverage(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+
+/* Defined in cursor.cpp */
+extern "C" SEXP contactsCursor(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern "C" SEXP contactsCursorNext(SEXP, SEXP);
+
+/* Defined in jobs.cpp */
+extern "C" SEXP contactsJobCancel(SEXP);
+extern "C" SEXP contactsJobResult(SEXP);
+extern "C" SEXP contactsJobStart(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP,
+                                 SEXP, SEXP);
+extern "C" SEXP contactsJobStatus(SEXP);
+
+/* Defined in movements.cpp */
+extern "C" SEXP contactsIndexArrow(SEXP, SEXP, SEXP);
+extern "C" SEXP contactsIndexFile(SEXP, SEXP, SEXP, SEXP);
+
+/* Defined in reachability.cpp */
+extern "C" SEXP reachabilityIndex(SEXP, SEXP, SEXP, SEXP);
+extern "C" SEXP reachable(SEXP, SEXP, SEXP, SEXP, SEXP);
+
+/* Defined in sample.cpp */
+extern "C" SEXP networkSummarySample(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP,
+                                     SEXP, SEXP, SEXP, SEXP);
+
+/* Defined in server.cpp */
+extern "C" SEXP contactsClientQuery(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP,
+                                    SEXP, SEXP);
+extern "C" SEXP contactsServerStart(SEXP, SEXP, SEXP, SEXP);
+extern "C" SEXP contactsServerStop(SEXP);
+
+/* Defined in simulation.cpp */
+extern "C" SEXP contactsSimulation(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP,
+                                   SEXP, SEXP, SEXP, SEXP);
+
+/* Defined in topk.cpp */
+extern "C" SEXP topContactChains(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+
+/* Defined in whatif.cpp */
+extern "C" SEXP contactsWhatIf(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+
 static const R_CallMethodDef callMethods[] =
 {
-    {"networkSummary", (DL_FUNC) &networkSummary, 9},
-    {"shortestPaths", (DL_FUNC) &shortestPaths, 9},
-    {"traceContacts", (DL_FUNC) &traceContacts, 10},
+    {"contactsCentrality", (DL_FUNC) &contactsCentrality, 5},
+    {"contactsClientQuery", (DL_FUNC) &contactsClientQuery, 8},
+    {"contactsCoverage", (DL_FUNC) &contactsCoverage, 7},
+    {"contactsCursor", (DL_FUNC) &contactsCursor, 7},
+    {"contactsCursorNext", (DL_FUNC) &contactsCursorNext, 2},
+    {"contactsIndex", (DL_FUNC) &contactsIndex, 5},
+    {"contactsIndexArrow", (DL_FUNC) &contactsIndexArrow, 3},
+    {"contactsIndexFile", (DL_FUNC) &contactsIndexFile, 4},
+    {"contactsJobCancel", (DL_FUNC) &contactsJobCancel, 1},
+    {"contactsJobResult", (DL_FUNC) &contactsJobResult, 1},
+    {"contactsJobStart", (DL_FUNC) &contactsJobStart, 9},
+    {"contactsJobStatus", (DL_FUNC) &contactsJobStatus, 1},
+    {"contactsServerStart", (DL_FUNC) &contactsServerStart, 4},
+    {"contactsServerStop", (DL_FUNC) &contactsServerStop, 1},
+    {"contactsSimulation", (DL_FUNC) &contactsSimulation, 11},
+    {"contactsWhatIf", (DL_FUNC) &contactsWhatIf, 8},
+    {"networkSummary", (DL_FUNC) &networkSummary, 12},
+    {"networkSummarySample", (DL_FUNC) &networkSummarySample, 10},
+    {"reachabilityIndex", (DL_FUNC) &reachabilityIndex, 4},
+    {"reachable", (DL_FUNC) &reachable, 5},
+    {"shortestPaths", (DL_FUNC) &shortestPaths, 10},
+    {"topContactChains", (DL_FUNC) &topContactChains, 6},
+    {"traceContacts", (DL_FUNC) &traceContacts, 11},
+    {"traceFragments", (DL_FUNC) &traceFragments, 11},
     {NULL, NULL, 0}
 };
 
@@ -0,0 +1,176 @@
+/*
+ * Copyright 2013-2020 Stefan Widgren and Maria Noremark,
+ * National Veterinary Institute, Sweden
+ *
+ * Licensed under the EUPL, Version 1.1 or - as soon they
+ * will be approved by the European Commission - subsequent
+ * versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the
+ * Licence.
+ * You may obtain a copy of the Licence at:
+ *
+ * http: *ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in
+ * writing, software distributed under the Licence is
+ * distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the Licence for the specific language governing
+ * permissions and limitations under the Licence.
+ */
+
+#ifndef INCLUDE_TRACE_H
+#define INCLUDE_TRACE_H
+
+#include "contacts.h"
+
+#include <vector>
+
+class VisitedNodes;
+class PathNodes;
+class ShortestPaths;
+
+/* Queries on a prepared contacts index for one root and time window
+ * at a time, without the R API, e.g. for the threads of the
+ * server. The instance holds the work memory of the traversals, so
+ * each thread needs its own instance, while the index is shared. The
+ * nodes are zero-based external identifiers. */
+class ContactsTracer {
+public:
+    ContactsTracer(const ContactsIndex& index);
+    ~ContactsTracer();
+
+    /* The inDegree, outDegree, ingoingContactChain and
+     * outgoingContactChain of the root, see NetworkSummary. */
+    void NetworkSummary(int root,
+                        int inBegin,
+                        int inEnd,
+                        int outBegin,
+                        int outEnd,
+                        int *result);
+
+    /* The inDegree, or outDegree, of the root, see InDegree and
+     * OutDegree. */
+    int Degree(int root, int tBegin, int tEnd, bool ingoing);
+
+    /* The ingoingContactChain, or outgoingContactChain, of the root,
+     * see IngoingContactChain and OutgoingContactChain. The contacts
+     * are not traced through the zero-based nodes in mask, as if
+     * their movements were removed, and the contact chain of a root
+     * in mask is empty. The nodes of the contact chain are stored in
+     * chain, if not NULL. */
+    int ContactChain(int root,
+                     int tBegin,
+                     int tEnd,
+                     bool ingoing,
+                     const std::vector<int> *mask = NULL,
+                     std::vector<int> *chain = NULL);
+
+    /* An upper, or lower, bound of the ingoingContactChain, or
+     * outgoingContactChain, of the root from the coarse level of the
+     * lookup, which must be built, see buildContactsCoarse. A chain
+     * of contacts in non-decreasing days is also a chain in
+     * non-decreasing periods, and a chain in increasing periods
+     * within the window is also a chain in increasing days. */
+    int ContactChainBound(int root,
+                          int tBegin,
+                          int tEnd,
+                          bool ingoing,
+                          bool upper);
+
+    /* The one-based rows and distances of the contacts of the root,
+     * see Trace. A maxDistance of 0 traces all contacts. */
+    void Trace(int root,
+               int tBegin,
+               int tEnd,
+               bool ingoing,
+               int maxDistance,
+               ContactsRowids& rowid,
+               std::vector<int>& distance);
+
+    /* The nodes in the contact chain of the root in increasing order
+     * and their shortest distance, see ShortestPaths. */
+    void ShortestPaths(int root,
+                       int tBegin,
+                       int tEnd,
+                       bool ingoing,
+                       std::vector<int>& node,
+                       std::vector<int>& distance);
+
+private:
+    const ContactsIndex& index;
+    VisitedNodes *visitedNodes;
+    PathNodes *path;
+    ::ShortestPaths *paths;
+
+    /* The queue of the traversals of the coarse level. */
+    std::vector<std::pair<int, int> > queue;
+
+    ContactsTracer(const ContactsTracer&);
+    ContactsTracer& operator=(const ContactsTracer&);
+};
+
+/* Append one tracer per thread of an entry point to tracers, see
+ * contactsThreads. Returns the number of threads. The caller deletes
+ * the tracers. */
+int contactsTracers(const ContactsIndex& index,
+                    int threads,
+                    std::vector<ContactsTracer*>& tracers);
+
+/* A resumable depth-first traversal that traces the contacts of one
+ * root at a time, in the same order as Trace, but yields the rows in
+ * chunks from an explicit stack instead of collecting all of them.
+ * The memory is the stack and the search path, independent of the
+ * number of rows. The lookups of the index must not change between
+ * the calls. */
+class TraceCursor {
+public:
+    TraceCursor(const ContactsIndex& index, int maxDistance);
+    ~TraceCursor();
+
+    /* Start to trace the contacts of the zero-based external root,
+     * see Trace. */
+    void Start(int root, int tBegin, int tEnd, bool ingoing);
+
+    /* Append at most n of the next rows, one-based, and distances.
+     * Returns the number of appended rows. The rowids must be
+     * cleared with the width of the index, see ContactsRowids. */
+    size_t Next(size_t n,
+                ContactsRowids& rowid,
+                std::vector<int>& distance);
+
+    /* No more rows for the root. */
+    bool Done(void) const {
+        return depth == 0;
+    }
+
+private:
+    struct Frame;
+
+    const ContactsIndex& index;
+    const ContactsLookup *data;
+    int maxDistance;
+    bool ingoing;
+    PathNodes *path;
+
+    /* The frames are reused by depth. */
+    std::vector<Frame*> frames;
+    size_t depth;
+
+    void Push(int node, int tBegin, int tEnd, int distance);
+
+    TraceCursor(const TraceCursor&);
+    TraceCursor& operator=(const TraceCursor&);
+};
+
+/* The upper bound of the contact chain, and the degree, of each
+ * internal node in [tBegin, tEnd], defined in topk.cpp. */
+void topBounds(const ContactsLookup& data,
+               int n,
+               int tBegin,
+               int tEnd,
+               std::vector<int>& bound,
+               std::vector<int>& degree);
+
+#endif
@@ -0,0 +1,302 @@
+/*
+ * Copyright 2013-2020 Stefan Widgren and Maria Noremark,
+ * National Veterinary Institute, Sweden
+ *
+ * Licensed under the EUPL, Version 1.1 or - as soon they
+ * will be approved by the European Commission - subsequent
+ * versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the
+ * Licence.
+ * You may obtain a copy of the Licence at:
+ *
+ * http: *ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in
+ * writing, software distributed under the Licence is
+ * distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied.
+ * See the Licence for the specific language governing
+ * permissions and limitations under the Licence.
+ */
+
+
+/*
+ * What-if analysis of the network summary when the movements of some
+ * holdings are removed, e.g. holdings that are closed by a movement
+ * ban, see NetworkSummaryWhatIf in R.
+ *
+ * The removed holdings are masked in the existing index instead of
+ * rebuilding it without their movements: they are visited before the
+ * root with a bound that can't be improved, so the contacts are
+ * never traced through them. The contact chain of a root can only
+ * change if it contains a removed holding, so the contact chains of
+ * all roots are first traced once, and the queries that reached each
+ * holding are recorded. Then only the queries that reached a removed
+ * holding, or with a removed root, are traced again in each
+ * scenario. The queries are traced in parallel with one
+ * ContactsTracer per thread.
+ */
+
+#include "trace.h"
+
+#include <algorithm>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* The queries that reached each node in one direction, in
+ * compressed sparse rows. The nodes are zero-based external
+ * identifiers. */
+class WhatIfReach {
+public:
+    WhatIfReach(int n, const std::vector<std::vector<int> >& chains)
+        : offset(n + 1, 0)
+        {
+            for (size_t i = 0; i < chains.size(); ++i) {
+                for (size_t j = 0; j < chains[i].size(); ++j)
+                    offset[chains[i][j] + 1]++;
+            }
+
+            for (int v = 0; v < n; ++v)
+                offset[v + 1] += offset[v];
+
+            std::vector<size_t> next(offset.begin(), offset.end() - 1);
+            query.resize(offset[n]);
+            for (size_t i = 0; i < chains.size(); ++i) {
+                for (size_t j = 0; j < chains[i].size(); ++j)
+                    query[next[chains[i][j]]++] = i;
+            }
+        }
+
+    std::vector<size_t> offset;
+    std::vector<int> query;
+};
+
+/* A query of a scenario to trace again. */
+struct WhatIfTask {
+    int scenario;
+    int query;
+    bool affected[2];
+    int size[2];
+};
+
+/* Order the tasks by scenario and query. */
+struct WhatIfTaskLess {
+    bool operator()(const WhatIfTask& a, const WhatIfTask& b) const {
+        if (a.scenario != b.scenario)
+            return a.scenario < b.scenario;
+        return a.query < b.query;
+    }
+};
+
+/* The network summary of the roots when the holdings in each
+ * scenario are removed.
+ *
+ * @param image the image of the index.
+ * @param root the one-based roots of the queries.
+ * @param inBegin the start of the ingoing window of each query.
+ * @param inEnd the end of the ingoing window of each query.
+ * @param outBegin the start of the outgoing window of each query.
+ * @param outEnd the end of the outgoing window of each query.
+ * @param remove a list with the one-based holdings to remove in each
+ * scenario.
+ * @param threads the number of threads, or 0 for the OpenMP default.
+ * @return a list with the ingoingContactChain and
+ * outgoingContactChain of each query without removed holdings, and
+ * the one-based scenario and query, and the ingoingContactChain and
+ * outgoingContactChain in the scenario, of the queries with a
+ * contact chain that changed.
+ */
+extern "C" SEXP contactsWhatIf(
+    SEXP image,
+    SEXP root,
+    SEXP inBegin,
+    SEXP inEnd,
+    SEXP outBegin,
+    SEXP outEnd,
+    SEXP remove,
+    SEXP threads)
+{
+    const char *names[] = {"ingoingContactChain", "outgoingContactChain",
+                           "scenario", "query", "ingoing", "outgoing", ""};
+    ContactsIndex index;
+    std::vector<ContactsTracer*> tracers;
+    std::vector<std::vector<int> > masks;
+    std::vector<std::vector<int> > chains[2];
+    std::vector<int> baseline[2];
+    std::vector<WhatIfTask> tasks;
+    const int *begin[2], *end[2];
+    int n, len, k;
+    SEXP result, vec;
+
+    len = Rf_length(root);
+    if (!Rf_isInteger(root) ||
+        !Rf_isInteger(inBegin) || Rf_length(inBegin) != len ||
+        !Rf_isInteger(inEnd) || Rf_length(inEnd) != len ||
+        !Rf_isInteger(outBegin) || Rf_length(outBegin) != len ||
+        !Rf_isInteger(outEnd) || Rf_length(outEnd) != len ||
+        !Rf_isVectorList(remove) ||
+        !Rf_isInteger(threads) || Rf_xlength(threads) != 1 ||
+        INTEGER(threads)[0] == NA_INTEGER || INTEGER(threads)[0] < 0 ||
+        readContactsIndex(index, image))
+        Rf_error("Unable to calculate the what-if network summary");
+
+    for (int i = 0; i < len; ++i) {
+        if (INTEGER(root)[i] == NA_INTEGER || INTEGER(root)[i] < 1 ||
+            INTEGER(root)[i] > index.N())
+            Rf_error("Unable to calculate the what-if network summary");
+    }
+
+    for (int s = 0; s < Rf_length(remove); ++s) {
+        SEXP holdings = VECTOR_ELT(remove, s);
+
+        if (!Rf_isInteger(holdings))
+            Rf_error("Unable to calculate the what-if network summary");
+
+        masks.push_back(std::vector<int>());
+        for (int i = 0; i < Rf_length(holdings); ++i) {
+            int v = INTEGER(holdings)[i];
+
+            if (v == NA_INTEGER || v < 1 || v > index.N())
+                Rf_error("Unable to calculate the what-if network summary");
+            masks.back().push_back(v - 1);
+        }
+    }
+
+    begin[0] = INTEGER(inBegin);
+    end[0] = INTEGER(inEnd);
+    begin[1] = INTEGER(outBegin);
+    end[1] = INTEGER(outEnd);
+
+    n = contactsTracers(index, INTEGER(threads)[0], tracers);
+
+    /* Trace the contact chains without removed holdings, and record
+     * the nodes that each query reached. */
+    for (int d = 0; d < 2; ++d) {
+        chains[d].resize(len);
+        baseline[d].resize(len);
+    }
+
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(n) schedule(dynamic, 16)
+#endif
+    for (int i = 0; i < 2 * len; ++i) {
+#ifdef _OPENMP
+        ContactsTracer *tracer = tracers[omp_get_thread_num()];
+#else
+        ContactsTracer *tracer = tracers[0];
+#endif
+        int d = i % 2, q = i / 2;
+
+        baseline[d][q] = tracer->ContactChain(INTEGER(root)[q] - 1,
+                                              begin[d][q], end[d][q],
+                                              d == 0, NULL, &chains[d][q]);
+    }
+
+    WhatIfReach in(index.N(), chains[0]);
+    WhatIfReach out(index.N(), chains[1]);
+    const WhatIfReach *reach[2] = {&in, &out};
+    for (int d = 0; d < 2; ++d)
+        std::vector<std::vector<int> >().swap(chains[d]);
+
+    /* The queries of each scenario that reached a removed holding, or
+     * with a removed root. */
+    std::vector<int> stamp(len, -1);
+    std::vector<size_t> taskOf(len);
+    std::vector<std::vector<int> > rootQueries(index.N());
+    for (int i = 0; i < len; ++i)
+        rootQueries[INTEGER(root)[i] - 1].push_back(i);
+
+    for (size_t s = 0; s < masks.size(); ++s) {
+        for (size_t j = 0; j < masks[s].size(); ++j) {
+            int v = masks[s][j];
+
+            for (int d = 0; d < 3; ++d) {
+                const int *q, *last;
+
+                if (d < 2) {
+                    q = reach[d]->query.empty() ? NULL :
+                        &reach[d]->query[0] + reach[d]->offset[v];
+                    last = q + (reach[d]->offset[v + 1] - reach[d]->offset[v]);
+                } else {
+                    q = rootQueries[v].empty() ? NULL : &rootQueries[v][0];
+                    last = q + rootQueries[v].size();
+                }
+
+                for (; q != last; ++q) {
+                    if (stamp[*q] != (int)s) {
+                        WhatIfTask task = {(int)s, *q, {false, false},
+                                           {baseline[0][*q], baseline[1][*q]}};
+                        stamp[*q] = s;
+                        taskOf[*q] = tasks.size();
+                        tasks.push_back(task);
+                    }
+
+                    if (d < 2) {
+                        tasks[taskOf[*q]].affected[d] = true;
+                    } else {
+                        tasks[taskOf[*q]].affected[0] = true;
+                        tasks[taskOf[*q]].affected[1] = true;
+                    }
+                }
+            }
+        }
+    }
+
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(n) schedule(dynamic, 16)
+#endif
+    for (int i = 0; i < 2 * (int)tasks.size(); ++i) {
+#ifdef _OPENMP
+        ContactsTracer *tracer = tracers[omp_get_thread_num()];
+#else
+        ContactsTracer *tracer = tracers[0];
+#endif
+        WhatIfTask& task = tasks[i / 2];
+        int d = i % 2, q = task.query;
+
+        if (task.affected[d]) {
+            task.size[d] = tracer->ContactChain(INTEGER(root)[q] - 1,
+                                                begin[d][q], end[d][q],
+                                                d == 0, &masks[task.scenario]);
+        }
+    }
+
+    PROTECT(result = Rf_mkNamed(VECSXP, names));
+    for (int d = 0; d < 2; ++d) {
+        SET_VECTOR_ELT(result, d, vec = Rf_allocVector(INTSXP, len));
+        for (int i = 0; i < len; ++i)
+            INTEGER(vec)[i] = baseline[d][i];
+    }
+
+    /* Only the tasks with a contact chain that changed. */
+    k = 0;
+    for (size_t t = 0; t < tasks.size(); ++t) {
+        if (tasks[t].size[0] != baseline[0][tasks[t].query] ||
+            tasks[t].size[1] != baseline[1][tasks[t].query])
+            tasks[k++] = tasks[t];
+    }
+    tasks.resize(k);
+    std::sort(tasks.begin(), tasks.end(), WhatIfTaskLess());
+
+    for (int j = 0; j < 4; ++j) {
+        SET_VECTOR_ELT(result, 2 + j, vec = Rf_allocVector(INTSXP, k));
+        for (int t = 0; t < k; ++t) {
+            switch (j) {
+            case 0: INTEGER(vec)[t] = tasks[t].scenario + 1; break;
+            case 1: INTEGER(vec)[t] = tasks[t].query + 1; break;
+            default: INTEGER(vec)[t] = tasks[t].size[j - 2]; break;
+            }
+        }
+    }
+
+    for (int i = 0; i < n; ++i)
+        delete tracers[i];
+
+    UNPROTECT(1);
+
+    return result;
+}